@@ -0,0 +1,143 @@
+/*----------------------------------------------------------------------------
+* Name:    Log.c
+* Purpose: Ring of binary log records, sent to the UART by LogDrain
+* Note(s): See Log.h. The records are formatted by host/log_decode.c
+*----------------------------------------------------------------------------*/
+
+#include "lpc17xx.h"
+#include "uart.h"
+#include "Log.h"
+
+/* The ring holds each record as a word with the argument count in bits 16
+   and up and the ID below, followed by the arguments. The head counts the
+   words written by LogWrite and the tail the words sent by LogDrain. Both
+   only count up, the ring index is the count modulo LOG_RING_WORDS */
+static volatile uint32_t LogRing[LOG_RING_WORDS];
+static volatile uint32_t LogHead = 0;
+static volatile uint32_t LogTail = 0;
+
+static volatile uint32_t LogLostCount = 0;
+//lost records LogDrain has sent a LOG_LOST record for
+static uint32_t LogLostSent = 0;
+
+/*----------------------------------------------------------------------------
+Store one record
+*----------------------------------------------------------------------------*/
+void LogWrite( uint32_t id, uint32_t count, uint32_t a, uint32_t b, uint32_t c, uint32_t d ) {
+	uint32_t args[LOG_MAX_ARGS];
+	uint32_t primask, head, i;
+
+	args[0] = a;
+	args[1] = b;
+	args[2] = c;
+	args[3] = d;
+
+	//a handler that logs can not come between the check and the stores
+	primask = __get_PRIMASK();
+	__disable_irq();
+
+	//more arguments would spill into the ID bits of the record on the line
+	head = LogHead;
+	if ( count > LOG_MAX_ARGS || head - LogTail + 1 + count > LOG_RING_WORDS ) {
+		LogLostCount++;
+		__set_PRIMASK( primask );
+		return;
+	}
+	LogRing[head & (LOG_RING_WORDS - 1)] = (count << 16) | id;
+	for ( i = 0; i < count; i++ ) {
+		LogRing[(head + 1 + i) & (LOG_RING_WORDS - 1)] = args[i];
+	}
+	LogHead = head + 1 + count;
+
+	__set_PRIMASK( primask );
+}
+
+uint32_t LogLost( void ) {
+
+	return LogLostCount;
+}
+
+/*----------------------------------------------------------------------------
+Append 'value' as unsigned LEB128, returns the bytes written, 1 to 5
+*----------------------------------------------------------------------------*/
+static uint32_t LogEncode( uint8_t *out, uint32_t value ) {
+	uint32_t length = 0;
+
+	while ( value >= 0x80 ) {
+		out[length++] = (uint8_t)(value | 0x80);
+		value >>= 7;
+	}
+	out[length++] = (uint8_t)value;
+
+	return length;
+}
+
+/*----------------------------------------------------------------------------
+Send one encoded record if the UART takes all of it now
+*----------------------------------------------------------------------------*/
+static uint32_t LogSend( uint8_t *record, uint32_t length ) {
+
+	#if LOG_PORT < 2
+		if ( UARTTxSpace( LOG_PORT ) < length ) {
+			return 0;
+		}
+		UARTSend( LOG_PORT, record, length );
+	#else
+		uint32_t i;
+
+		for ( i = 0; i < length; i++ ) {
+			UARTSendChar( LOG_PORT, record[i] );
+		}
+	#endif
+
+	return 1;
+}
+
+/*----------------------------------------------------------------------------
+Send the records in the ring, oldest first, while the UART has room.
+Only one caller at a time, eg. the main loop
+*----------------------------------------------------------------------------*/
+uint32_t LogDrain( void ) {
+	uint8_t record[1 + 5 * (1 + LOG_MAX_ARGS)];
+	uint32_t tail, header, count, length, lost, i;
+	uint32_t sent = 0;
+
+	while ( LogTail != LogHead ) {
+		tail = LogTail;
+		header = LogRing[tail & (LOG_RING_WORDS - 1)];
+		count = header >> 16;
+
+		record[0] = LOG_SYNC;
+		length = 1 + LogEncode( &record[1], ((header & 0xFFFF) << 3) | count );
+		for ( i = 0; i < count; i++ ) {
+			length += LogEncode( &record[length], LogRing[(tail + 1 + i) & (LOG_RING_WORDS - 1)] );
+		}
+		if ( !LogSend( record, length ) ) {
+			break;
+		}
+
+		LogTail = tail + 1 + count;
+		sent++;
+	}
+
+	//after the records that filled the ring
+	lost = LogLostCount - LogLostSent;
+	if ( lost != 0 && LogTail == LogHead ) {
+		record[0] = LOG_SYNC;
+		length = 1 + LogEncode( &record[1], (LOG_LOST << 3) | 1 );
+		length += LogEncode( &record[length], lost );
+		if ( LogSend( record, length ) ) {
+			LogLostSent += lost;
+			sent++;
+		}
+	}
+
+	return sent;
+}
+
+void LogFlush( void ) {
+
+	do {
+		LogDrain();
+	} while ( LogTail != LogHead || LogLostCount != LogLostSent );
+}
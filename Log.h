@@ -0,0 +1,69 @@
+/*----------------------------------------------------------------------------
+* Name:    Log.h
+* Purpose: Logging without formatting on the device
+* Note(s): A message is listed once in LOG_MESSAGES with its printf format,
+*          which gives it the ID LOG_<name> at compile time. LOGn(name, ...)
+*          only stores the ID and the n argument words in a RAM ring, with
+*          interrupts masked for a few instructions, so it may be called from
+*          an interrupt handler too. LogDrain, called from the main loop,
+*          sends what the ring holds to the UART as compact binary records,
+*          and host/log_decode.c formats them on the PC with the same list.
+*          Text printed with printf on the same port passes through the
+*          decoder unchanged.
+*----------------------------------------------------------------------------*/
+
+#ifndef __LOG_H
+#define __LOG_H
+
+#include <stdint.h>
+
+#ifndef LOG_PORT
+#define LOG_PORT		0		/* UART the records are sent on, 10 for the ITM */
+#endif
+#define LOG_RING_WORDS	256		/* words of the ring, a power of two */
+#define LOG_MAX_ARGS	4
+
+/* Every record on the line starts with LOG_SYNC. The rest are unsigned
+   LEB128 numbers, 7 bits per byte with the top bit set on all but the
+   last byte: first the ID times 8 plus the argument count, then each
+   argument. A record takes 2 to 22 bytes */
+#define LOG_SYNC		0xA5
+
+/* X(name, format). The format may use %u, %d, %x and %c of 32 bit words,
+   one per argument. Append new messages at the end, so the IDs of older
+   captures stay valid */
+#define LOG_MESSAGES(X) \
+	X(LOST,            "[log: %u records lost, the ring was full]\n") \
+	X(BOOT,            "boot, core clock %u Hz\n") \
+	X(UART_RX_ERRORS,  "UART%u: %u overruns, %u framing errors, %u dropped\n") \
+	X(HEAP_ALLOC,      "alloc of %u bytes at %x\n") \
+	X(HEAP_FREE,       "free at %x\n") \
+	X(HEAP_FAILED,     "alloc of %u bytes failed\n")
+
+typedef enum {
+#define LOG_ENUM(name, format)  LOG_##name,
+	LOG_MESSAGES(LOG_ENUM)
+#undef LOG_ENUM
+	LOG_COUNT
+} LOG_ID;
+
+#define LOG_ARG(arg)	((uint32_t)(unsigned long)(arg))
+
+#define LOG0(name)					LogWrite(LOG_##name, 0, 0, 0, 0, 0)
+#define LOG1(name, a)				LogWrite(LOG_##name, 1, LOG_ARG(a), 0, 0, 0)
+#define LOG2(name, a, b)			LogWrite(LOG_##name, 2, LOG_ARG(a), LOG_ARG(b), 0, 0)
+#define LOG3(name, a, b, c)			LogWrite(LOG_##name, 3, LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), 0)
+#define LOG4(name, a, b, c, d)		LogWrite(LOG_##name, 4, LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d))
+
+/* Stores one record, or counts it as lost when the ring is full or
+   'count' is above LOG_MAX_ARGS */
+void     LogWrite( uint32_t id, uint32_t count, uint32_t a, uint32_t b, uint32_t c, uint32_t d );
+/* Sends the records that fit into the UART's transmit ring without
+   waiting. Returns the number of records sent */
+uint32_t LogDrain( void );
+/* Sends every record, waiting for room on the UART */
+void     LogFlush( void );
+/* Records lost since start up */
+uint32_t LogLost( void );
+
+#endif /* end __LOG_H */
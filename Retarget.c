@@ -16,6 +16,7 @@
 
 #include <stdio.h>
 #include <rt_misc.h>
+#include "Retarget.h"
 
 #ifdef __RTGT_GLCD
 	#include "GLCD_Scroll.h"
@@ -46,6 +47,51 @@ volatile uint8_t glcd_init_called = 0;
 volatile uint8_t uart_init_called = 0;
 #endif
 
+#if defined( __RTGT_UART ) || defined( __DBG_ITM )
+//stdout not sent yet, line ends already expanded to CR LF
+static uint8_t stdout_buffer[STDOUT_BUFSIZE];
+static uint32_t stdout_length = 0;
+static int stdout_mode = _IOLBF;
+#endif
+
+/*----------------------------------------------------------------------------
+Send the buffered stdout in one go
+*----------------------------------------------------------------------------*/
+void RetargetFlush( void ) {
+
+	#if defined( __RTGT_UART ) || defined( __DBG_ITM )
+	#ifdef __DBG_ITM
+	uint32_t i;
+	#endif
+
+	if ( stdout_length == 0 ) {
+		return;
+	}
+
+	#ifdef __RTGT_UART
+		UARTSend( PORT_NUM, stdout_buffer, stdout_length );
+	#else
+		//the ITM takes one character at a time
+		for ( i = 0; i < stdout_length; i++ ) {
+			UARTSendChar( PORT_NUM, stdout_buffer[i] );
+		}
+	#endif
+
+	stdout_length = 0;
+	#endif
+}
+
+/*----------------------------------------------------------------------------
+Choose when stdout is flushed, _IOFBF, _IOLBF or _IONBF
+*----------------------------------------------------------------------------*/
+void RetargetBufferMode( int mode ) {
+
+	#if defined( __RTGT_UART ) || defined( __DBG_ITM )
+	RetargetFlush();
+	stdout_mode = mode;
+	#endif
+}
+
 /*----------------------------------------------------------------------------
 Write character to Serial Port
 *----------------------------------------------------------------------------*/
@@ -71,10 +117,20 @@ int sendchar( int c ) {
 
 	#endif
 	
+	#if defined( __RTGT_UART ) || defined( __DBG_ITM )
+	//room for a CR LF, a line end is never split over two sends
+	if ( stdout_length + 2 > STDOUT_BUFSIZE ) {
+		RetargetFlush();
+	}
+	#endif
+
 	if ( c == '\r' || c == '\n' ) {
 		#if defined( __RTGT_UART ) || defined( __DBG_ITM )
-			UARTSendChar( PORT_NUM, 0x0D );
-			UARTSendChar( PORT_NUM, 0x0A );
+			stdout_buffer[stdout_length++] = 0x0D;
+			stdout_buffer[stdout_length++] = 0x0A;
+			if ( stdout_mode != _IOFBF ) {
+				RetargetFlush();
+			}
 		#endif
 
 		#ifdef __RTGT_GLCD
@@ -82,7 +138,10 @@ int sendchar( int c ) {
 		#endif
 	} else {
 		#if defined(__RTGT_UART) || defined(__DBG_ITM)
-			UARTSendChar(PORT_NUM, c);
+			stdout_buffer[stdout_length++] = c;
+			if ( stdout_mode == _IONBF ) {
+				RetargetFlush();
+			}
 		#endif
 		#ifdef __RTGT_GLCD
 			CharAppend(c);
@@ -108,6 +167,9 @@ int getkey( void ) {
 	}
 	#endif
 	
+	//a prompt is seen before the read waits
+	RetargetFlush();
+
 	#if defined( __RTGT_UART ) || defined( __DBG_ITM )
 		return UARTReceiveChar( PORT_NUM );
 	#else
@@ -131,6 +193,7 @@ int fgetc( FILE *f ) {
 	int ch = getkey();
 
 	sendchar( ch );
+	RetargetFlush();
 
 	return ch;
 }
@@ -146,10 +209,17 @@ int ferror( FILE *f ) {
 void _ttywrch( int ch ) {
 
 	sendchar(ch);
+	RetargetFlush();
 }
 
 
 void _sys_exit( int return_code ) {
 
+	RetargetFlush();
+	#ifdef __RTGT_UART
+		//the ring drains by interrupt, wait for it to leave the line
+		UARTTxFlush( PORT_NUM );
+	#endif
+
 label:  goto label;  /* endless loop */
 }
@@ -0,0 +1,25 @@
+/*----------------------------------------------------------------------------
+* Name:    Retarget.h
+* Purpose: Buffering of the retargeted stdout
+* Note(s): Characters written to stdout are collected in one buffer with
+*          '\n' expanded to CR LF, and go to the UART with a single
+*          UARTSend (or to the ITM) when the buffer is flushed. The GLCD
+*          still gets every character right away.
+*----------------------------------------------------------------------------*/
+
+#ifndef __RETARGET_H
+#define __RETARGET_H
+
+#include <stdio.h>
+
+#define STDOUT_BUFSIZE	128		/* bytes of stdout collected before a flush */
+
+/* 'mode' is _IOFBF to flush only when the buffer is full, _IOLBF to also
+   flush at the end of every line (the default) or _IONBF to flush after
+   every character */
+void RetargetBufferMode( int mode );
+/* Sends everything buffered so far. Returns once it is queued on the
+   UART, not when it has left the line */
+void RetargetFlush( void );
+
+#endif /* end __RETARGET_H */
@@ -0,0 +1,61 @@
+
+#include "half_capture.h"
+#include "half_fit.h"
+#include "half_port.h"
+
+#ifdef HALF_CAPTURE
+
+#ifdef HALF_CONCURRENT
+// keeps the sequence numbers in the order the records are written
+static half_lock_t capture_lock;
+#define lock_capture()    half_lock_acquire(&capture_lock)
+#define unlock_capture()  half_lock_release(&capture_lock)
+#else
+#define lock_capture()
+#define unlock_capture()
+#endif
+
+static FILE * capture_out;
+static U32 capture_sequence;
+
+void half_capture_start(FILE * out) {
+    half_capture_header_t header;
+
+    header.magic = half_capture_magic;
+    header.record_size = sizeof(half_capture_record_t);
+    header.heap_size = half_default_heap.total_size;
+    header.reserved = 0;
+
+    lock_capture();
+    fwrite(&header, sizeof(header), 1, out);
+    capture_sequence = 0;
+    capture_out = out;
+    unlock_capture();
+}
+
+void half_capture_stop(void) {
+    lock_capture();
+    if (capture_out) {
+        fflush(capture_out);
+    }
+    capture_out = NULL;
+    unlock_capture();
+}
+
+void half_capture(U32 op, U32 size, void * address, U32 argument) {
+    half_capture_record_t record;
+
+    record.op = op;
+    record.size = size > half_capture_max_sz ? half_capture_max_sz : size;
+    record.offset = half_capture_offset(address);
+    record.argument = argument;
+
+    lock_capture();
+    if (capture_out) {
+        record.sequence = capture_sequence++;
+        fwrite(&record, sizeof(record), 1, capture_out);
+    }
+    unlock_capture();
+}
+
+#endif /* HALF_CAPTURE */
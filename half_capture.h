@@ -0,0 +1,105 @@
+#ifndef HALF_CAPTURE_H_
+#define HALF_CAPTURE_H_
+
+/*
+ * Capture of the calls made to the default heap, compiled in with HALF_CAPTURE.
+ *
+ * Between half_capture_start and half_capture_stop every half_init, half_alloc, half_free,
+ * half_realloc, half_memalign, half_alloc_batch and half_free_batch call is written to a stream
+ * as a 16 byte record. host/half_replay.c runs a capture against the allocator again. Addresses
+ * are recorded as offsets into the heap's regions counted one after the other, from 0 to the
+ * heap's total_size, so a replay built with the same flags hands out the same offsets.
+ *
+ * Records are numbered in the order they are written: frees before the block is released, the
+ * other calls after they return. Calls made by several threads at once still interleave, a
+ * realloc in particular, so such a capture replays but may not map identically.
+ */
+
+#include "type.h"
+#include "half_fit.h"
+#include <stdio.h>
+
+#define half_capture_magic  0x31504348 // "HCP1"
+#define half_capture_null   0xFFFFFFFF // the offset recorded for NULL
+#define half_capture_max_sz 0x00FFFFFF // larger sizes are recorded as this, they fail anyway
+
+typedef enum {
+    // the heap was set up again: size is the bytes in all its regions
+    HC_INIT,
+    // size, offset returned
+    HC_ALLOC,
+    // offset freed
+    HC_FREE,
+    // size, offset returned, argument is the offset passed in
+    HC_REALLOC,
+    // size, offset returned, argument is the alignment
+    HC_MEMALIGN,
+    // one record per block handed out, one with a NULL offset if there was none: size, offset
+    // returned, argument is the block's index in the high 16 bits and the number of blocks asked
+    // for in the low 16 bits
+    HC_ALLOC_BATCH,
+    // one record per address passed in: offset freed, argument as for HC_ALLOC_BATCH
+    HC_FREE_BATCH,
+    HC_COUNT
+} half_capture_op_t;
+
+typedef struct {
+    U32 sequence;
+    // a half_capture_op_t
+    unsigned int op : 8;
+    unsigned int size : 24;
+    U32 offset;
+    U32 argument;
+} half_capture_record_t;
+
+/**
+ * Written by half_capture_start in front of the records
+ */
+typedef struct {
+    // half_capture_magic
+    U32 magic;
+    // sizeof(half_capture_record_t), checked by the replay
+    U32 record_size;
+    // bytes in the default heap when the capture started, 0 before half_init. The HC_INIT records
+    // carry the size the heap was set up with
+    U32 heap_size;
+    U32 reserved;
+} half_capture_header_t;
+
+#define half_capture_batch_argument(index, count)  (((U32)(index) << 16) | ((U32)(count) & 0xFFFF))
+
+/**
+ * Offset of an address in the default heap, half_capture_null for NULL. Each region starts where
+ * the one added before it ends. An address in no region is taken from the first
+ */
+static __inline U32 half_capture_offset(void * address) {
+    U32 offset = 0;
+    U32 i;
+
+    if (address == NULL) {
+        return half_capture_null;
+    }
+    for (i = 0; i < half_default_heap.region_count; i++) {
+        if ((U32)((U8 *)address - half_default_heap.regions[i].base) < half_default_heap.regions[i].size) {
+            return offset + (U32)((U8 *)address - half_default_heap.regions[i].base);
+        }
+        offset += half_default_heap.regions[i].size;
+    }
+    return (U32)((U8 *)address - half_default_heap.base);
+}
+
+#ifdef HALF_CAPTURE
+
+// Writes a half_capture_header_t to 'out' and the record of every call from now on
+void half_capture_start( FILE * out );
+// Flushes the stream and stops recording
+void half_capture_stop( void );
+void half_capture( U32 op, U32 size, void * address, U32 argument );
+
+#else
+
+#define half_capture(op, size, address, argument)  ((void)0)
+
+#endif
+
+#endif
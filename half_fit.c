@@ -1,201 +1,1737 @@
 #include "half_fit.h"
 #include <lpc17xx.h>
 #include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
 #include <stdbool.h>
 #include <limits.h>
 #include "uart.h"
+#include "half_port.h"
+#include "half_capture.h"
+#include "half_latency.h"
+#ifdef HALF_TCACHE
+#include "half_tcache.h"
+#endif
+#ifdef HALF_SLAB
+#include "half_slab.h"
+#endif
+#ifdef HALF_QUICK
+#include "half_quick.h"
+#endif
+#ifdef HALF_HANDLE
+#include "half_handle.h"
+#endif
 
-const int BYTES_TO_BIT_SHIFT = 3;
-const int BUCKET_COUNT = 11; // 32-63, 64-127, 128-255, 256-511; 512-1023, 1024-2047, 2048, 4096, 8192, 16384-32767, 32768
-const int HEADER_SIZE = 32; // bits
+const int BUCKET_COUNT = bucket_cnt; // each power of two from 32 to 32768 bytes in 4 linear steps, e.g. 1024, 1280, 1536, 1792-2047
 const int HEADER_SIZE_BYTES = 4;
 const int CHUNK_SIZE_POWER = 5; // 2^5 = 32 bytes
 const int CHUNK_SIZE = 1 << CHUNK_SIZE_POWER; // 32 bytes
-const int CHUNK_SIZE_BITS = (1 << CHUNK_SIZE_POWER) << BYTES_TO_BIT_SHIFT; // 256 bits
-const int MAX_SIZE_BITS = CHUNK_SIZE_BITS<<10; // bits
-const int MAX_SIZE = CHUNK_SIZE<<10; // 1024*32 bytes
+const int MAX_SIZE = 32<<10; // 1024*32 bytes, the most a 10 bit chunk offset can address
 // set aside memory (32 kB)
-unsigned char memory_pool[MAX_SIZE] __attribute__ ((section(".ARM.__at_0x10000000"), zero_init));
+#ifdef LPC17XX_HOST
+// aligned to its size like the pool at 0x10000000 on the target, so aligned allocations land on the
+// same offsets in both
+unsigned char memory_pool[32<<10] __attribute__ ((aligned(32<<10)));
+#else
+unsigned char memory_pool[32<<10] __attribute__ ((section(".ARM.__at_0x10000000"), zero_init));
+#endif
 void * memory_address = &memory_pool;
+#ifdef HALF_AHB_REGION
+// the upper 16 kB AHB SRAM bank, added to the default heap by half_init. memory_pool takes all of
+// IRAM1, so the program's own data and stack live in the lower bank from 0x2007C000
+#ifdef LPC17XX_HOST
+unsigned char ahb_pool[16<<10] __attribute__ ((aligned(16<<10)));
+#else
+unsigned char ahb_pool[16<<10] __attribute__ ((section(".ARM.__at_0x20080000"), zero_init));
+#endif
+#endif
 
-struct bit_vector_t bit_vector;
+half_heap_t half_default_heap;
 
-void *bucket_heads[BUCKET_COUNT];
+#ifdef HALF_CONCURRENT
+// Lock order is merge_lock, then a bucket lock. Only one bucket lock is held at a time
+#define lock_bucket(heap, index)    half_lock_acquire(&(heap)->bucket_locks[index])
+#define unlock_bucket(heap, index)  half_lock_release(&(heap)->bucket_locks[index])
+#define lock_merge(heap)            half_lock_acquire(&(heap)->merge_lock)
+#define unlock_merge(heap)          half_lock_release(&(heap)->merge_lock)
+#else
+#define lock_bucket(heap, index)
+#define unlock_bucket(heap, index)
+#define lock_merge(heap)
+#define unlock_merge(heap)
+#endif
 
-__inline void * to_pointer(unsigned int x) {
-    //todo remove this debugging check
-    if ((x - (U32)(memory_address)) >= 32768) {
-        printf("Memory address out of bounds %d", x);
+#ifdef HALF_CONCURRENT
+#define count_add(heap, counter, delta)  half_atomic_add(&(heap)->counter, (U32)(delta))
+#define count_read(heap, counter)        half_atomic_load(&(heap)->counter)
+#define count_max(heap, counter, value)  half_atomic_max(&(heap)->counter, (U32)(value))
+#else
+#define count_add(heap, counter, delta)  ((heap)->counter += (U32)(delta))
+#define count_read(heap, counter)        ((heap)->counter)
+#define count_max(heap, counter, value)  ((heap)->counter = (U32)(value) > (heap)->counter ? (U32)(value) : (heap)->counter)
+#endif
+
+#ifdef HALF_CONCURRENT
+typedef union {
+    block_header_t header;
+    U32 word;
+} header_word_t;
+
+/**
+ * Reads a block header in one load. An allocation marks the block it takes allocated holding only
+ * its bucket lock, so headers of blocks that may be on a list are read this way
+ */
+static __inline block_header_t read_header(block_header_t *block) {
+    header_word_t word;
+
+    word.word = half_atomic_load((half_atomic_t *)block);
+    return word.header;
+}
+#else
+#define read_header(block)  (*(block))
+#endif
+
+#if defined(HALF_NO_CLZ) || !(defined(__CC_ARM) || defined(__GNUC__))
+/**
+ * floor(log2(i)) for every byte, for targets without a count leading zeros instruction
+ */
+const U8 half_log2_table[256] = {
+    0, 0, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 3, 3,
+    4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4, 4,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5, 5,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7
+};
+#endif
+
+static __inline U32 read_first_level(half_heap_t *heap) {
+#ifdef HALF_CONCURRENT
+    return half_atomic_load(&heap->bit_vector.first_level);
+#else
+    return heap->bit_vector.first_level;
+#endif
+}
+
+static __inline U32 read_second_level(half_heap_t *heap, U32 first_level) {
+#ifdef HALF_CONCURRENT
+    return half_atomic_load(&heap->bit_vector.second_level[first_level]);
+#else
+    return heap->bit_vector.second_level[first_level];
+#endif
+}
+
+static __inline void set_bucket_bit(half_heap_t *heap, U32 bucket_index) {
+    U32 first_level = bucket_index >> sl_bits;
+
+#ifdef HALF_CONCURRENT
+    half_atomic_or(&heap->bit_vector.second_level[first_level], 1u << (bucket_index & (sl_cnt - 1)));
+    half_atomic_or(&heap->bit_vector.first_level, 1u << first_level);
+#else
+    heap->bit_vector.second_level[first_level] |= 1 << (bucket_index & (sl_cnt - 1));
+    heap->bit_vector.first_level = heap->bit_vector.first_level | (1 << first_level);
+#endif
+}
+
+static __inline void clear_bucket_bit(half_heap_t *heap, U32 bucket_index) {
+    U32 first_level = bucket_index >> sl_bits;
+
+#ifdef HALF_CONCURRENT
+    half_atomic_and(&heap->bit_vector.second_level[first_level], ~(1u << (bucket_index & (sl_cnt - 1))));
+    if (half_atomic_load(&heap->bit_vector.second_level[first_level]) == 0) {
+        half_atomic_and(&heap->bit_vector.first_level, ~(1u << first_level));
+        // a bucket of the same power of two may have been filled in between
+        if (half_atomic_load(&heap->bit_vector.second_level[first_level]) != 0) {
+            half_atomic_or(&heap->bit_vector.first_level, 1u << first_level);
+        }
+    }
+#else
+    heap->bit_vector.second_level[first_level] &= ~(1 << (bucket_index & (sl_cnt - 1)));
+    if (heap->bit_vector.second_level[first_level] == 0) {
+        heap->bit_vector.first_level = heap->bit_vector.first_level & ~(1 << first_level);
     }
+#endif
+}
+
+static __inline BOOL read_bucket_bit(half_heap_t *heap, U32 bucket_index) {
+    return (read_second_level(heap, bucket_index >> sl_bits) >> (bucket_index & (sl_cnt - 1))) & 1;
+}
+
+/**
+ * Size in bytes of the smallest block that belongs to a bucket
+ */
+static __inline U32 bucket_min_size(U32 bucket_index) {
+    U32 first_level = bucket_index >> sl_bits;
 
-    return (void*)(long)(x);
+    return (((bucket_index & (sl_cnt - 1)) + sl_cnt) << first_level >> sl_bits) << CHUNK_SIZE_POWER;
+}
+
+/**
+ * Gives the index of the region an address is in, 0 if it is in none
+ */
+static __inline U32 region_of(half_heap_t *heap, void * address) {
+    U32 i;
+
+    // a heap with only its first region never searches
+    for (i = heap->region_count - 1; i > 0; i--) {
+        if ((U32)((U8 *)address - heap->regions[i].base) < heap->regions[i].size) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Converts a byte offset inside a region to a pointer
+ */
+static __inline void * to_pointer(half_heap_t *heap, U32 region_index, U32 offset) {
+#ifdef HALF_DEBUG
+    if (offset >= heap->regions[region_index].size) {
+        mprint(HT_OFFSET_OUT_OF_BOUNDS, offset);
+    }
+#endif
+
+    return heap->regions[region_index].base + offset;
+}
+
+/**
+ * Gives the byte offset of the given address from the start of the heap. Every region starts
+ * a multiple of 32 bytes from there, so the offset tells where in its chunk an address is
+ */
+static __inline U32 to_offset(half_heap_t *heap, void * address) {
+    return (U32)((U8 *)address - heap->base);
+}
+
+static __inline unused_block_header_t * bucket_links(void * block) {
+    return (unused_block_header_t *)((U8 *)block + HEADER_SIZE_BYTES);
+}
+
+static __inline void * previous_in_bucket(half_heap_t *heap, void * block) {
+    unused_block_header_t * links = bucket_links(block);
+
+    return expand_link(heap, links->previous_region, links->previous_block, block);
+}
+
+static __inline void * next_in_bucket(half_heap_t *heap, void * block) {
+    unused_block_header_t * links = bucket_links(block);
+
+    return expand_link(heap, links->next_region, links->next_block, block);
+}
+
+/**
+ * Links a free block to the block before it in its bucket, or to itself to indicate null
+ */
+static __inline void set_previous_in_bucket(half_heap_t *heap, void * block, void * previous) {
+    unused_block_header_t * links = bucket_links(block);
+
+    links->previous_block = shorten_address(heap, previous);
+    links->previous_region = region_of(heap, previous);
+}
+
+/**
+ * Links a free block to the block after it in its bucket, or to itself to indicate null
+ */
+static __inline void set_next_in_bucket(half_heap_t *heap, void * block, void * next) {
+    unused_block_header_t * links = bucket_links(block);
+
+    links->next_block = shorten_address(heap, next);
+    links->next_region = region_of(heap, next);
 }
 
 void  half_init(void){
+#if HALF_TRACE == HALF_TRACE_RING
+    half_trace_init();
+#elif defined(HALF_LATENCY)
+    half_cycles_init();
+#endif
+#ifdef HALF_TCACHE
+    // blocks cached by any thread belong to the old heap
+    half_tcache_invalidate();
+#endif
+    half_init_heap(&half_default_heap, memory_address, MAX_SIZE);
+#ifdef HALF_AHB_REGION
+    half_add_region_to(&half_default_heap, ahb_pool, sizeof(ahb_pool));
+#endif
+    half_capture(HC_INIT, half_default_heap.total_size, NULL, 0);
+}
+
+BOOL  half_add_region(void * memory, U32 size){
+    return half_add_region_to(&half_default_heap, memory, size);
+}
+
+void *half_alloc(U32 size){
+    void * address;
+
+#ifdef HALF_TCACHE
+    address = half_tcache_alloc(size);
+#else
+    address = half_alloc_from(&half_default_heap, size);
+#endif
+    half_capture(HC_ALLOC, size, address, 0);
+    return address;
+}
+
+void  half_free(void * address){
+    // recorded first, so a capture never shows the block handed out again before it was freed
+    half_capture(HC_FREE, 0, address, 0);
+#ifdef HALF_TCACHE
+    half_tcache_free(address);
+#else
+    half_free_to(&half_default_heap, address);
+#endif
+}
+
+void *half_realloc(void * address, U32 size){
+    void * new_address;
+
+#ifdef HALF_TCACHE
+    new_address = half_tcache_realloc(address, size);
+#else
+    new_address = half_realloc_in(&half_default_heap, address, size);
+#endif
+    half_capture(HC_REALLOC, size, new_address, half_capture_offset(address));
+    return new_address;
+}
+
+U32 half_alloc_batch(U32 size, U32 count, void ** addresses){
+    U32 allocated;
+#ifdef HALF_CAPTURE
+    U32 i;
+#endif
+
+#ifdef HALF_TCACHE
+    allocated = half_tcache_alloc_batch(size, count, addresses);
+#else
+    allocated = half_alloc_batch_from(&half_default_heap, size, count, addresses);
+#endif
+#ifdef HALF_CAPTURE
+    for (i = 0; i < allocated; i++) {
+        half_capture(HC_ALLOC_BATCH, size, addresses[i], half_capture_batch_argument(i, count));
+    }
+    if (allocated == 0) {
+        half_capture(HC_ALLOC_BATCH, size, NULL, half_capture_batch_argument(0, count));
+    }
+#endif
+    return allocated;
+}
+
+void  half_free_batch(void ** addresses, U32 count){
+#ifdef HALF_CAPTURE
+    U32 i;
+
+    // before the call, which sorts the addresses
+    for (i = 0; i < count; i++) {
+        half_capture(HC_FREE_BATCH, 0, addresses[i], half_capture_batch_argument(i, count));
+    }
+#endif
+#ifdef HALF_TCACHE
+    half_tcache_free_batch(addresses, count);
+#else
+    half_free_batch_to(&half_default_heap, addresses, count);
+#endif
+}
+
+BOOL  half_check(U32 budget){
+#ifdef HALF_TCACHE
+    return half_tcache_check(budget);
+#else
+    return half_check_heap(&half_default_heap, budget);
+#endif
+}
+
+void  half_set_fit_policy(U32 policy, U32 scan){
+    half_set_fit_policy_of(&half_default_heap, policy, scan);
+}
+
+void  half_get_stats(struct half_stats * stats){
+#ifdef HALF_TCACHE
+    half_tcache_get_stats(stats);
+#else
+    half_get_stats_of(&half_default_heap, stats);
+#endif
+}
+
+void *half_memalign(U32 alignment, U32 size){
+    void * address;
+
+#ifdef HALF_TCACHE
+    address = half_tcache_memalign(alignment, size);
+#else
+    address = half_memalign_from(&half_default_heap, alignment, size);
+#endif
+    half_capture(HC_MEMALIGN, size, address, alignment);
+    return address;
+}
+
+/**
+ * Empties every bucket and the bit vector, and releases the locks
+ */
+static void clear_buckets(half_heap_t *heap) {
     U32 i;
+
+    // create bit vector that contains whether buckets are empty or not
+    heap->bit_vector.first_level = 0;
+    for (i = 0; i < fl_cnt; i++) {
+        heap->bit_vector.second_level[i] = 0;
+    }
+
+    for (i = 0; i < BUCKET_COUNT; i++) {
+        heap->bucket_heads[i] = 0;
+        heap->bucket_free_bytes[i] = 0;
+        heap->bucket_free_blocks[i] = 0;
+        heap->bucket_largest[i] = 0;
+#ifdef HALF_CONCURRENT
+        heap->bucket_locks[i] = 0;
+#endif
+    }
+#ifdef HALF_CONCURRENT
+    heap->merge_lock = 0;
+    heap->in_flight = 0;
+#endif
+    heap->check_cursor = heap->base;
+#ifdef HALF_HANDLE
+    heap->compact_cursor = heap->base;
+#endif
+    heap->free_bytes = 0;
+}
+
+/**
+ * Sets up a heap over the given memory. The whole memory becomes one free block.
+ * @param heap The heap to initialize
+ * @param memory Start of the pool, must be 4 byte aligned
+ * @param size Size of the pool in bytes. Rounded down to a multiple of 32, and must be at most 32768
+ * @return __TRUE if the heap was set up, __FALSE if the memory can not hold a heap
+ */
+BOOL  half_init_heap(half_heap_t *heap, void * memory, U32 size){
     U32 short_address = 0;
-    block_header_t * header = (block_header_t *)(memory_address);
-    mprint0("Starting init\n");
+    block_header_t * header = (block_header_t *)(memory);
+    mprint0(HT_INIT_START);
+
+    size = size & ~(U32)(CHUNK_SIZE-1);
+    if (memory == NULL || ((U32)(long)memory & (HEADER_SIZE_BYTES-1)) != 0 || size < (U32)CHUNK_SIZE || size > (U32)MAX_SIZE) {
+        mprint2(HT_INIT_BAD_POOL, memory, size);
+        return __FALSE;
+    }
+
+    heap->base = (U8 *)memory;
+    heap->size = size;
+    heap->regions[0].base = heap->base;
+    heap->regions[0].size = size;
+    heap->region_count = 1;
+    heap->total_size = size;
+
     header->next_block = short_address;
     header->previous_block = short_address;
-    header->block_size = shorten_block_size(MAX_SIZE_BITS);
+    header->block_size = shorten_block_size(size);
     header->allocated = 0;
 
-    // create bit vector that contains whether buckets are empty or not
-    bit_vector.buckets = 0;
+    clear_buckets(heap);
+    heap->fit_policy = HALF_FIT_HEAD;
+    heap->fit_scan = fit_scan_default;
+    heap->peak_used_bytes = 0;
+    heap->alloc_count = 0;
+    heap->failed_alloc_count = 0;
+    heap->free_count = 0;
+#ifdef HALF_SLAB
+    half_slab_init(heap);
+#endif
+#ifdef HALF_QUICK
+    half_quick_init(heap);
+#endif
+#ifdef HALF_HANDLE
+    half_handle_init(heap);
+#endif
+    // add reserved memory to the bucket matching its size
+    add_to_known_bucket(heap, memory, (U32)get_bucket_index(size));
 
-    for (i = 0; i < BUCKET_COUNT; i++) {
-        bucket_heads[i] = 0;
+    mprint0(HT_INIT_END);
+    return __TRUE;
+}
+
+/**
+ * Gives a heap more memory that need not be next to its pool. The region becomes one free block
+ * in the heap's buckets, with no neighbours outside the region. Add regions before the heap is
+ * used by more than one thread
+ * @param heap A heap set up with half_init_heap
+ * @param memory Start of the region. Must be a multiple of 32 bytes from the start of the pool,
+ *        so payloads sit at the same place in their chunk in every region
+ * @param size Size of the region in bytes. Rounded down to a multiple of 32, and must be at most 32768
+ * @return __TRUE if the region was added, __FALSE if the heap has region_cnt regions already or
+ *         the memory can not be a region
+ */
+BOOL  half_add_region_to(half_heap_t *heap, void * memory, U32 size){
+    block_header_t * header = (block_header_t *)(memory);
+    half_region_t * region;
+    U32 i;
+
+    size = size & ~(U32)(CHUNK_SIZE-1);
+    if (memory == NULL || heap->region_count == region_cnt || size < (U32)CHUNK_SIZE || size > (U32)MAX_SIZE
+            || (((unsigned long)memory - (unsigned long)heap->base) & (CHUNK_SIZE-1)) != 0) {
+        mprint2(HT_REGION_BAD, memory, size);
+        return __FALSE;
+    }
+    for (i = 0; i < heap->region_count; i++) {
+        region = &heap->regions[i];
+        if ((U8 *)memory < region->base + region->size && region->base < (U8 *)memory + size) {
+            mprint2(HT_REGION_BAD, memory, size);
+            return __FALSE;
+        }
+    }
+    mprint3(HT_REGION_ADD, heap->region_count, memory, size);
+
+    header->next_block = 0;
+    header->previous_block = 0;
+    header->block_size = shorten_block_size(size);
+    header->allocated = 0;
+
+    lock_merge(heap);
+    region = &heap->regions[heap->region_count];
+    region->base = (U8 *)memory;
+    region->size = size;
+    heap->region_count++;
+    heap->total_size += size;
+
+    i = (U32)get_bucket_index(size);
+    lock_bucket(heap, i);
+    add_to_known_bucket(heap, memory, i);
+    unlock_bucket(heap, i);
+    unlock_merge(heap);
+    return __TRUE;
+}
+
+#ifdef HALF_CONCURRENT
+#define begin_in_flight(heap)  half_atomic_add(&(heap)->in_flight, 1)
+#define end_in_flight(heap)    half_atomic_add(&(heap)->in_flight, (U32)-1)
+
+/**
+ * Decides whether a failed find_bucket means the heap really has no block for the size.
+ * Blocks that a split or merge in another thread has off the lists will come back, so this waits
+ * out any free in progress and only gives up if no allocation is splitting a block either.
+ */
+static BOOL out_of_memory(half_heap_t *heap, U32 effective_size) {
+    BOOL empty;
+
+    lock_merge(heap);
+    empty = find_bucket(heap, effective_size) == -1 && half_atomic_load(&heap->in_flight) == 0;
+    unlock_merge(heap);
+    if (!empty) {
+        half_yield();
     }
-    // add reserved memory to largest bucket
-    add_to_known_bucket(memory_address, BUCKET_COUNT-1);
+    return empty;
+}
+#else
+#define begin_in_flight(heap)
+#define end_in_flight(heap)
+#define out_of_memory(heap, effective_size)  __TRUE
+#endif
+
+/**
+ * Gives the blocks that the slab layer and the quick lists hold back to the heap, before an
+ * allocation gives up
+ * @return __TRUE if there were any
+ */
+static BOOL reclaim_blocks(half_heap_t *heap) {
+    BOOL reclaimed = __FALSE;
 
-    mprint0("Ending init\n");
+    (void)heap;
+#ifdef HALF_SLAB
+    reclaimed = half_slab_trim(heap);
+#endif
+#ifdef HALF_QUICK
+    // coalesced in bulk, the free blocks they merge into may fit where each one alone did not
+    reclaimed = half_quick_flush(heap) || reclaimed;
+#endif
+    return reclaimed;
 }
 
 /**
- * Allocates a block of memory of 'size' bytes or greater. Size of memory will be a multiple of 32
+ * Allocates memory of 'size' bytes or greater from the given heap
+ * @param heap
  * @param size
- * @return Pointer
+ * @return Pointer, NULL if the heap has no room
  */
-void *half_alloc(U32 size){
-    // effective size of size+4. We'll be using that from now on
-    U32 block_size;
-    block_header_t *header;
-    void * first_block_address;
-    U32 effective_size = round_up_to_chunk_size(size+HEADER_SIZE_BYTES); // bytes
+void *half_alloc_from(half_heap_t *heap, U32 size){
+    void * address = NULL;
+#ifdef HALF_LATENCY
+    U32 start = half_latency_start();
+#endif
+
+#ifdef HALF_SLAB
+    if (size <= slab_max_sz) {
+        // NULL if there is no room for a new slab, a whole block may still fit
+        address = half_slab_alloc(heap, size);
+    }
+#endif
+#ifdef HALF_QUICK
+    if (address == NULL) {
+        address = half_quick_alloc(heap, size);
+    }
+#endif
+    if (address == NULL) {
+        address = allocate_block(heap, size);
+        if (address == NULL && reclaim_blocks(heap)) {
+            address = allocate_block(heap, size);
+        }
+    }
+    if (address) {
+        count_add(heap, alloc_count, 1);
+    } else {
+        count_add(heap, failed_alloc_count, 1);
+    }
+    half_latency(HL_ALLOC, start, size);
+    return address;
+}
+
+/**
+ * Finds the block of a payload placed by half_memalign
+ * @return The payload address the block would have without the alignment, NULL if there is no
+ *         valid marker before the given address
+ */
+static void * aligned_block_payload(half_heap_t *heap, void * address) {
+    aligned_marker_t * marker = (aligned_marker_t *)((U8 *)address - HEADER_SIZE_BYTES);
+    half_region_t * region = &heap->regions[region_of(heap, marker)];
+    U32 block_offset;
 
-    // find bucket
-    signed int bucket_index = find_bucket(effective_size);
-    mprint2("Starting alloc for size: %d, effective_size: %d\n", size, effective_size);
-    if (bucket_index == -1) {
+    if ((U8 *)address < region->base + (HEADER_SIZE_BYTES << 1) || (U8 *)address > region->base + region->size) {
+        return NULL;
+    }
+    // the marker is in the first chunk of its block, past the header
+    block_offset = (U32)((U8 *)marker - region->base) & ~(U32)(CHUNK_SIZE-1);
+    if (marker->magic != aligned_magic || marker->block != (block_offset >> CHUNK_SIZE_POWER)) {
         return NULL;
     }
+    return region->base + block_offset + HEADER_SIZE_BYTES;
+}
 
-    // take first block from bucket
-    first_block_address = bucket_heads[bucket_index];
-    header = (block_header_t *)(first_block_address);
+/**
+ * Bytes usable at an address that is not 4 bytes into a chunk, a slab slot or an aligned payload
+ * @return The size, 0 if the address is neither
+ */
+static U32 offset_payload_size(half_heap_t *heap, void * address) {
+    U8 * payload;
+    U32 size;
 
-    if (first_block_address) {
-        // Remove allocated block from its bucket, by modifying the points of its neighbours
-        remove_head_from_known_bucket(first_block_address, (U32)bucket_index);
+#ifdef HALF_SLAB
+    size = half_slab_slot_size(heap, address);
+    if (size) {
+        return size;
+    }
+#endif
+    payload = (U8 *)aligned_block_payload(heap, address);
+    if (payload == NULL) {
+        return 0;
+    }
+    lock_merge(heap);
+    size = expand_block_size(((block_header_t *)(payload - HEADER_SIZE_BYTES))->block_size);
+    unlock_merge(heap);
+    return size - (U32)((U8 *)address - payload) - HEADER_SIZE_BYTES;
+}
 
-        // split block if >= 32 bytes larger than requested size
-        // block size should be in bytes
-        block_size = expand_block_size(header->block_size);
+/**
+ * Moves the cursors of half_check and half_compact off a block that is about to be merged into the
+ * block before it, leaving a stale header behind. Must be called holding the merge lock
+ */
+static __inline void merge_into(half_heap_t *heap, block_header_t *block, block_header_t *into) {
+    if (heap->check_cursor == block) {
+        heap->check_cursor = into;
+    }
+#ifdef HALF_HANDLE
+    if (heap->compact_cursor == block) {
+        heap->compact_cursor = into;
+    }
+#endif
+}
 
-        if (block_size >= effective_size + CHUNK_SIZE) {
-            U32 new_block_size;
-            S32 new_bucket_index;
-            void * new_block_address;
-            U32 new_block_short_address;
-            block_header_t *new_header;
-            block_header_t * next_block;
-            U32 short_address;
-            mprint("Block size %d is bigger than requested size, splitting\n", block_size);
-            // create new free block, add to bucket
-            mprint("math: %d\n", block_size - effective_size);
-            new_block_size = block_size - effective_size;
-            new_block_address = to_pointer((int)(header) + (effective_size<<BYTES_TO_BIT_SHIFT));
-            mprint("new block header at %d\n", new_block_address);
-            new_block_short_address = shorten_address(new_block_address); // 10 bit address
-
-            // update the header of the newly created block
-            new_header = (block_header_t *)(new_block_address);
-            mprint0("Assigning header values");
-            new_header->block_size = shorten_block_size(new_block_size);
-            mprint0("Assigning next_block");
-            new_header->next_block = header->next_block;
-
-            short_address = shorten_address(first_block_address);
-            new_header->previous_block = short_address;
-            new_header->allocated = 0;
-
-            // update previous block of next block
-            mprint0("Updating next block");
-            next_block = (block_header_t*)(expand_address(header->next_block, (U32)header));
-            if (next_block) {
-                next_block->previous_block = new_block_short_address;
-            }
+/**
+ * Takes a free block off its bucket list so it can be merged. Returns __FALSE if the block is
+ * allocated, also if an allocation took it off its list since its header was read.
+ * Must be called holding the merge lock.
+ */
+static BOOL claim_free_block(half_heap_t *heap, block_header_t *block) {
+    block_header_t header = read_header(block);
+    U32 bucket_index;
+    BOOL listed = __TRUE;
 
-            // Add new block to appropriate bucket
-            mprint0("Adding to bucket");
-            new_bucket_index = get_bucket_index(new_block_size);
-            if (new_bucket_index == -1) {
-                mprint("Invalid index for new bucket of size %d", new_block_size);
+    if (header.allocated) {
+        return __FALSE;
+    }
+    // the size of a free block only changes under the merge lock
+    bucket_index = (U32)get_bucket_index(expand_block_size(header.block_size));
+    lock_bucket(heap, bucket_index);
+#ifdef HALF_CONCURRENT
+    // an allocation marks the block it takes under this lock, and its data may be in the links by now
+    listed = !read_header(block).allocated;
+#endif
+    if (listed) {
+        remove_from_known_bucket(heap, block, bucket_index);
+    }
+    unlock_bucket(heap, bucket_index);
+    return listed;
+}
+
+/**
+ * Points the previous link of a block at 'previous'. A free block may be marked allocated by an
+ * allocation meanwhile, so its header is written under its bucket lock. Must be called holding the
+ * merge lock
+ */
+static void set_previous_block(half_heap_t *heap, block_header_t *block, U32 previous) {
+#ifdef HALF_CONCURRENT
+    block_header_t header = read_header(block);
+    U32 bucket_index;
+
+    if (!header.allocated) {
+        bucket_index = (U32)get_bucket_index(expand_block_size(header.block_size));
+        lock_bucket(heap, bucket_index);
+        block->previous_block = previous;
+        unlock_bucket(heap, bucket_index);
+        return;
+    }
+#else
+    (void)heap;
+#endif
+    block->previous_block = previous;
+}
+
+/**
+ * Cuts an allocated block in two at 'effective_size' bytes. Both parts stay allocated.
+ * Must be called holding the merge lock
+ * @return The header of the second part
+ */
+static block_header_t * carve_block(half_heap_t *heap, block_header_t *header, U32 effective_size) {
+    block_header_t * new_header = (block_header_t *)((U8 *)header + effective_size);
+    block_header_t * next_block = (block_header_t *)expand_address(heap, header->next_block, header);
+    U32 new_block_short_address = shorten_address(heap, new_header);
+
+    if (next_block) {
+        new_header->next_block = header->next_block;
+        // free if the block was split before, as in half_memalign
+        set_previous_block(heap, next_block, new_block_short_address);
+    } else {
+        new_header->next_block = new_block_short_address; // last block, point to null
+    }
+    new_header->previous_block = shorten_address(heap, header);
+    new_header->block_size = shorten_block_size(expand_block_size(header->block_size) - effective_size);
+    new_header->allocated = 1;
+
+    header->block_size = shorten_block_size(effective_size);
+    header->next_block = new_block_short_address;
+    return new_header;
+}
+
+/**
+ * Cuts the given block down to 'effective_size' bytes and puts the rest in a bucket as a new free
+ * block, merged with the next block if that one is free. Must be called holding the merge lock
+ * @param heap
+ * @param header Block that is at least 32 bytes larger than effective_size, off the bucket lists
+ * @param effective_size New size of the block in bytes, a multiple of 32
+ */
+static void split_block(half_heap_t *heap, block_header_t *header, U32 effective_size) {
+    U32 new_block_size;
+    S32 new_bucket_index;
+    void * new_block_address;
+    U32 new_block_short_address;
+    block_header_t *new_header;
+    block_header_t * next_block;
+    U32 block_size = expand_block_size(header->block_size);
+#ifdef HALF_LATENCY
+    U32 start = half_latency_start();
+#endif
+
+    // create new free block, add to bucket
+    mprint(HT_SPLIT_REMAINDER, block_size - effective_size);
+    new_block_size = block_size - effective_size;
+    new_block_address = (U8 *)header + effective_size;
+    mprint(HT_SPLIT_HEADER, new_block_address);
+    new_block_short_address = shorten_address(heap, new_block_address); // 10 bit address
+
+    // update the header of the newly created block
+    new_header = (block_header_t *)(new_block_address);
+    mprint0(HT_SPLIT_LINK_NEXT);
+    next_block = (block_header_t*)(expand_address(heap, header->next_block, header));
+    // a block handed out by allocate_block never has a free neighbour, a block being shrunk can
+    if (next_block && claim_free_block(heap, next_block)) {
+        merge_into(heap, next_block, new_header);
+        new_block_size += expand_block_size(next_block->block_size);
+        next_block = (block_header_t*)(expand_address(heap, next_block->next_block, next_block));
+    }
+    mprint0(HT_SPLIT_SET_HEADER);
+    new_header->block_size = shorten_block_size(new_block_size);
+    if (next_block) {
+        new_header->next_block = shorten_address(heap, next_block);
+    } else {
+        new_header->next_block = new_block_short_address; // last block, point to null
+    }
+
+    new_header->previous_block = shorten_address(heap, header);
+    new_header->allocated = 0;
+
+    // update previous block of next block
+    mprint0(HT_SPLIT_UPDATE_NEXT);
+    if (next_block) {
+        next_block->previous_block = new_block_short_address;
+    }
+
+    // Add new block to appropriate bucket
+    mprint0(HT_SPLIT_ADD_TO_BUCKET);
+    new_bucket_index = get_bucket_index(new_block_size);
+    if (new_bucket_index == -1) {
+        mprint(HT_SPLIT_BAD_BUCKET, new_block_size);
+    }
+    lock_bucket(heap, new_bucket_index);
+    add_to_known_bucket(heap, new_block_address, (U32)new_bucket_index);
+    unlock_bucket(heap, new_bucket_index);
+
+    // Change the size of this header
+    header->block_size = shorten_block_size(effective_size);
+    // update pointers
+    header->next_block = new_block_short_address;
+    half_latency(HL_SPLIT, start, block_size);
+}
+
+/**
+ * Raises the high water mark if the heap has never had this little free
+ */
+static __inline void update_peak(half_heap_t *heap) {
+    count_max(heap, peak_used_bytes, heap->total_size - count_read(heap, free_bytes));
+}
+
+/**
+ * Marks a block that is being taken off its list allocated. Must be called holding its bucket lock,
+ * nothing else writes the header of a block on a list. Once it is marked, frees of its neighbours
+ * may rewrite its previous link, so its size is read here
+ * @return The size of the block in bytes
+ */
+static __inline U32 mark_allocated(block_header_t *block) {
+#ifdef HALF_CONCURRENT
+    header_word_t word;
+
+    word.header = *block;
+    word.header.allocated = 1;
+    // in one store, for read_header
+    half_atomic_store((half_atomic_t *)block, word.word);
+    return expand_block_size(word.header.block_size);
+#else
+    block->allocated = 1;
+    return expand_block_size(block->block_size);
+#endif
+}
+
+/**
+ * Looks for a block of 'effective_size' bytes or more among the first fit_scan blocks of the bucket
+ * the size falls in, below the bucket find_bucket would take a block from. HALF_FIT_BEST takes the
+ * smallest that fits, HALF_FIT_ADDRESS the first. In concurrent mode the allocation counts as in
+ * flight until end_in_flight if a block is returned
+ * @param block_size Set to the size of the block returned
+ * @return The block, off its list and marked allocated, NULL if none of the blocks looked at fits
+ */
+static block_header_t * take_fitting_block(half_heap_t *heap, U32 effective_size, U32 *block_size) {
+    S32 bucket_index = get_bucket_index(effective_size);
+    block_header_t * block;
+    block_header_t * best = NULL;
+    U32 best_size = 0;
+    U32 size;
+    U32 i;
+
+    // when the size is the smallest of its bucket every block there fits, find_bucket takes one
+    if (bucket_index == -1 || bucket_index == get_guaranteed_bucket(effective_size) || !read_bucket_bit(heap, (U32)bucket_index)) {
+        return NULL;
+    }
+
+    begin_in_flight(heap);
+    lock_bucket(heap, bucket_index);
+    block = (block_header_t *)heap->bucket_heads[bucket_index];
+    for (i = 0; block != NULL && i < heap->fit_scan; i++) {
+        size = expand_block_size(block->block_size);
+        if (size >= effective_size && (best == NULL || size < best_size)) {
+            best = block;
+            best_size = size;
+            if (heap->fit_policy == HALF_FIT_ADDRESS || size == effective_size) {
+                break;
             }
-            add_to_known_bucket(new_block_address, (U32)new_bucket_index);
+        }
+        block = (block_header_t *)next_in_bucket(heap, block);
+    }
+    if (best) {
+        mprint(HT_FIT_TAKE, best);
+        remove_from_known_bucket(heap, best, (U32)bucket_index);
+        *block_size = mark_allocated(best);
+    }
+    unlock_bucket(heap, bucket_index);
+    if (best == NULL) {
+        end_in_flight(heap);
+    }
+    return best;
+}
 
+/**
+ * Takes the first block of the smallest bucket that is guaranteed to hold 'effective_size' bytes
+ * off its list and marks it allocated. In concurrent mode the allocation counts as in flight until
+ * end_in_flight
+ * @param heap
+ * @param effective_size Size including the header, a multiple of 32
+ * @param block_size Set to the size of the block returned
+ * @return The block, NULL if no block is large enough
+ */
+static block_header_t * take_block(half_heap_t *heap, U32 effective_size, U32 *block_size) {
+    // NULL for the loop condition when the first find_bucket finds nothing
+    void * first_block_address = NULL;
+    signed int bucket_index;
 
-            // Change the size of this header
-            header->block_size = shorten_block_size(effective_size);
-            // update pointers
-            header->next_block = new_block_short_address;
+    if (heap->fit_policy != HALF_FIT_HEAD && (first_block_address = take_fitting_block(heap, effective_size, block_size)) != NULL) {
+        return (block_header_t *)(first_block_address);
+    }
+
+    // find bucket and take its first block. In concurrent mode another thread can empty the
+    // bucket between find_bucket and taking the lock, so look again until a block is found
+    do {
+        bucket_index = find_bucket(heap, effective_size);
+        if (bucket_index == -1) {
+            if (out_of_memory(heap, effective_size)) {
+                return NULL;
+            }
+            continue;
         }
 
-        header->allocated = 1;
+        // counted before the block leaves the list, so out_of_memory never misses it
+        begin_in_flight(heap);
+        lock_bucket(heap, bucket_index);
+        first_block_address = heap->bucket_heads[bucket_index];
+        if (first_block_address) {
+            // Remove allocated block from its bucket, by modifying the points of its neighbours
+            remove_head_from_known_bucket(heap, first_block_address, (U32)bucket_index);
+            // under the bucket lock, so a free merging with the block sees it taken either way
+            *block_size = mark_allocated((block_header_t *)first_block_address);
+        }
+        unlock_bucket(heap, bucket_index);
+        if (first_block_address == NULL) {
+            end_in_flight(heap);
+        }
+    } while (first_block_address == NULL);
 
-        mprint0("Ending alloc\n");
-        return to_pointer((U32)first_block_address + HEADER_SIZE);
+    return (block_header_t *)(first_block_address);
+}
 
-    } else {
-        mprint("No address in bucket %d. Returning null", bucket_index);
+/**
+ * Allocates a block of memory of 'size' bytes or greater. Size of memory will be a multiple of 32
+ * @param heap
+ * @param size
+ * @return Pointer
+ */
+void *allocate_block(half_heap_t *heap, U32 size){
+    // effective size of size+4. We'll be using that from now on
+    U32 block_size;
+    block_header_t *header;
+    U32 effective_size;
+
+    if (size > heap->total_size) {
         return NULL;
     }
+    effective_size = round_up_to_chunk_size(size+HEADER_SIZE_BYTES); // bytes
+
+    mprint2(HT_ALLOC_START, size, effective_size);
+    header = take_block(heap, effective_size, &block_size);
+    if (header == NULL) {
+        return NULL;
+    }
+
+    // split block if >= 32 bytes larger than requested size
+    // block size should be in bytes
+    if (block_size >= effective_size + CHUNK_SIZE) {
+        mprint(HT_ALLOC_SPLIT, block_size);
+        lock_merge(heap);
+        split_block(heap, header, effective_size);
+        unlock_merge(heap);
+    }
+    update_peak(heap);
+    end_in_flight(heap);
+
+    mprint0(HT_ALLOC_END);
+    return (U8 *)header + HEADER_SIZE_BYTES;
 }
 
-void  half_free(void * address){
+/**
+ * Marks a block free, merges it with free neighbours and puts the result in its bucket.
+ * Must be called holding the merge lock
+ */
+static void release_block(half_heap_t *heap, block_header_t *header) {
     U32 new_block_size;
-    S32 next_bucket_index;
-    S32 previous_bucket_index;
     S32 new_block_bucket;
-    block_header_t * header;
-    block_header_t * new_header;
     block_header_t * previous_block;
     block_header_t * next_block;
     block_header_t * new_next_block;
-    // free the block at the given address
-    // create a new block from the adjacent blocks, if they are unallocated
-    void * effective_address = to_pointer((U32)address - HEADER_SIZE);
-    mprint("Starting free address %d\n", address);
-    header = (block_header_t *)(effective_address);
     // pointer to the location of the new header
-    new_header = header;
+    block_header_t * new_header = header;
+#ifdef HALF_LATENCY
+    U32 start = half_latency_start();
+    U32 block_size = expand_block_size(header->block_size);
+#endif
 
+    // marked free before any size changes, so a merge that stops part way leaves free neighbours
+    // behind that half_rebuild_heap can join, never an allocated block over free space
+    header->allocated = 0;
     new_block_size = expand_block_size(header->block_size);
-    previous_block = (block_header_t *)expand_address(header->previous_block, (U32)effective_address);
-    next_block = (block_header_t *)expand_address(header->next_block, (U32)effective_address);
+    previous_block = (block_header_t *)expand_address(heap, header->previous_block, header);
+    next_block = (block_header_t *)expand_address(heap, header->next_block, header);
     // pointer to the block after the new block
     new_next_block = next_block;
 
-    if (next_block && !next_block->allocated) {
+    if (next_block && claim_free_block(heap, next_block)) {
+        merge_into(heap, next_block, header);
         new_block_size += expand_block_size(next_block->block_size);
-        new_next_block = (block_header_t *)expand_address(next_block->next_block, (U32)next_block);
-
-        next_bucket_index = get_bucket_index(next_block->block_size);
-        remove_from_known_bucket(next_block, (U32)next_bucket_index);
+        new_next_block = (block_header_t *)expand_address(heap, next_block->next_block, next_block);
     }
-    if (previous_block && !previous_block->allocated) {
+    if (previous_block && claim_free_block(heap, previous_block)) {
+        merge_into(heap, header, previous_block);
         new_block_size += expand_block_size(previous_block->block_size);
         new_header = previous_block;
-        previous_bucket_index = get_bucket_index(previous_block->block_size);
-        remove_from_known_bucket(previous_block, (U32)previous_bucket_index);
     }
 
     new_header->block_size = shorten_block_size(new_block_size);
-    new_header->allocated = 0;
 
     if (new_next_block) {
-        new_header->next_block = shorten_address(new_next_block);
+        new_header->next_block = shorten_address(heap, new_next_block);
+        new_next_block->previous_block = shorten_address(heap, new_header);
     } else {
-        new_header->next_block = shorten_address(new_header); // point to null
+        new_header->next_block = shorten_address(heap, new_header); // point to null
     }
 
     // add block to appropriate bucket
     new_block_bucket = get_bucket_index(new_block_size);
     // todo handle -1 (size is invalid)
-    add_to_known_bucket(new_header, (U32)new_block_bucket);
-    mprint0("Ending free\n");
+    lock_bucket(heap, new_block_bucket);
+    add_to_known_bucket(heap, new_header, (U32)new_block_bucket);
+    unlock_bucket(heap, new_block_bucket);
+    half_latency(HL_COALESCE, start, block_size);
+}
+
+/**
+ * Gives the payload address that sits 4 bytes after the block header for any allocated address.
+ * Slab slots are freed right away
+ * @return The payload, NULL if the address was a slab slot or is not allocated
+ */
+static void * block_payload(half_heap_t *heap, void * address) {
+    void * payload = address;
+
+    // block payloads start 4 bytes into a chunk, slab slots and aligned payloads never do
+    if ((to_offset(heap, address) & (CHUNK_SIZE-1)) != HEADER_SIZE_BYTES) {
+#ifdef HALF_SLAB
+        if (half_slab_free(heap, address)) {
+            return NULL;
+        }
+#endif
+        payload = aligned_block_payload(heap, address);
+        if (payload == NULL) {
+            mprint(HT_BAD_ADDRESS, address);
+        }
+    }
+    return payload;
+}
+
+void  half_free_to(half_heap_t *heap, void * address){
+#ifdef HALF_LATENCY
+    U32 start = half_latency_start();
+    U32 block_size = 0;
+#endif
+
+    if (address == NULL) {
+        return;
+    }
+    count_add(heap, free_count, 1);
+    address = block_payload(heap, address);
+    if (address == NULL) {
+        // a slab slot, or not allocated at all
+        half_latency(HL_FREE, start, block_size);
+        return;
+    }
+#ifdef HALF_LATENCY
+    // read while the block is still allocated, so only this call can change its size
+    block_size = expand_block_size(((block_header_t *)((U8 *)address - HEADER_SIZE_BYTES))->block_size);
+#endif
+#ifdef HALF_QUICK
+    if (half_quick_free(heap, address)) {
+        half_latency(HL_FREE, start, block_size);
+        return;
+    }
+#endif
+    free_block(heap, address);
+    half_latency(HL_FREE, start, block_size);
+}
+
+/**
+ * Frees the block whose payload starts at the given address, without counting it as a call
+ * to half_free. For blocks the allocator took for itself, e.g. slabs
+ */
+void  free_block(half_heap_t *heap, void * address){
+    // free the block at the given address
+    // create a new block from the adjacent blocks, if they are unallocated
+    mprint(HT_FREE_START, address);
+
+    lock_merge(heap);
+    release_block(heap, (block_header_t *)((U8 *)address - HEADER_SIZE_BYTES));
+    unlock_merge(heap);
+    mprint0(HT_FREE_END);
+}
+
+#ifdef HALF_HANDLE
+/**
+ * Moves an allocated block down to the start of the free block before it. The free space ends up
+ * after the block, merged with the block after that if it is free. Must be called holding the
+ * merge lock, with the free block off its list
+ * @return The header of the free block left behind
+ */
+static block_header_t * slide_block(half_heap_t *heap, block_header_t *free_header, block_header_t *header) {
+    U32 free_size = expand_block_size(free_header->block_size);
+    U32 block_size = expand_block_size(header->block_size);
+    block_header_t * next_block = (block_header_t *)expand_address(heap, header->next_block, header);
+    block_header_t * rest;
+
+    merge_into(heap, header, free_header);
+    memmove((U8 *)free_header + HEADER_SIZE_BYTES, (U8 *)header + HEADER_SIZE_BYTES, block_size - HEADER_SIZE_BYTES);
+    free_header->block_size = shorten_block_size(block_size);
+    free_header->allocated = 1;
+
+    // allocated until release_block merges it and puts it in a bucket
+    rest = (block_header_t *)((U8 *)free_header + block_size);
+    rest->block_size = shorten_block_size(free_size);
+    rest->allocated = 1;
+    rest->previous_block = shorten_address(heap, free_header);
+    free_header->next_block = shorten_address(heap, rest);
+    if (next_block) {
+        rest->next_block = shorten_address(heap, next_block);
+        set_previous_block(heap, next_block, shorten_address(heap, rest));
+    } else {
+        rest->next_block = shorten_address(heap, rest); // last block, point to null
+    }
+    release_block(heap, rest);
+    return rest;
+}
+
+/**
+ * Looks at up to 'budget' blocks from where the last call stopped and slides every block of an
+ * unpinned handle that follows a free block down into it. Must be called holding the handle lock
+ * @return The number of blocks moved
+ */
+U32 compact_blocks(half_heap_t *heap, U32 budget){
+    block_header_t * header;
+    block_header_t * next_block;
+    block_header_t block;
+    half_handle_entry_t * entry;
+    U32 moved = 0;
+
+    lock_merge(heap);
+    // always a block start, merges and slides move it to the block that takes its place
+    header = (block_header_t *)heap->compact_cursor;
+
+    while (budget-- > 0) {
+        block = read_header(header);
+        next_block = (block_header_t *)expand_address(heap, block.next_block, header);
+        if (!block.allocated && next_block && read_header(next_block).allocated
+                && (entry = half_handle_movable(heap, (U8 *)next_block + HEADER_SIZE_BYTES)) != NULL
+                && claim_free_block(heap, header)) {
+            mprint2(HT_COMPACT_MOVE, next_block, header);
+            // the free block's header becomes the moved block's
+            half_handle_moved(heap, entry, (U8 *)header + HEADER_SIZE_BYTES);
+            header = slide_block(heap, header, next_block);
+            moved++;
+            continue;
+        }
+        header = next_block ? next_block
+               : (block_header_t *)heap->regions[(region_of(heap, header) + 1) % heap->region_count].base;
+    }
+
+    heap->compact_cursor = header;
+    unlock_merge(heap);
+    return moved;
+}
+#endif
+
+/**
+ * Allocates up to 'count' blocks of 'size' bytes or greater. A free block large enough for the
+ * whole batch is taken off its bucket once and cut up, instead of searching the buckets per block
+ * @param heap
+ * @param size
+ * @param count
+ * @param addresses Receives the allocations
+ * @return How many blocks were allocated, less than count if the heap ran out of room
+ */
+U32 half_alloc_batch_from(half_heap_t *heap, U32 size, U32 count, void ** addresses){
+    U32 allocated = 0;
+    U32 effective_size;
+    U32 wanted_size;
+    U32 block_size;
+    block_header_t * header;
+
+#ifdef HALF_SLAB
+    if (size <= slab_max_sz) {
+        while (allocated < count && (addresses[allocated] = half_alloc_from(heap, size)) != NULL) {
+            allocated++;
+        }
+        return allocated;
+    }
+#endif
+    if (size > heap->total_size) {
+        return 0;
+    }
+    effective_size = round_up_to_chunk_size(size+HEADER_SIZE_BYTES);
+    mprint2(HT_BATCH_ALLOC_START, count, size);
+
+    while (allocated < count) {
+        // a block for the rest of the batch if there is one, otherwise any block that fits one more
+        header = NULL;
+        wanted_size = (count - allocated) * effective_size;
+        if (wanted_size > effective_size && wanted_size <= heap->total_size && find_bucket(heap, wanted_size) != -1) {
+            header = take_block(heap, wanted_size, &block_size);
+        }
+        if (header == NULL) {
+            header = take_block(heap, effective_size, &block_size);
+        }
+        if (header == NULL) {
+            if (reclaim_blocks(heap)) {
+                continue;
+            }
+            break;
+        }
+
+        addresses[allocated++] = (U8 *)header + HEADER_SIZE_BYTES;
+        if (block_size >= effective_size + CHUNK_SIZE) {
+            lock_merge(heap);
+            while (allocated < count && block_size >= effective_size << 1) {
+                header = carve_block(heap, header, effective_size);
+                block_size -= effective_size;
+                addresses[allocated++] = (U8 *)header + HEADER_SIZE_BYTES;
+            }
+            if (block_size >= effective_size + CHUNK_SIZE) {
+                split_block(heap, header, effective_size);
+            }
+            unlock_merge(heap);
+        }
+        update_peak(heap);
+        end_in_flight(heap);
+    }
+    count_add(heap, alloc_count, allocated);
+    if (allocated < count) {
+        count_add(heap, failed_alloc_count, 1);
+    }
+
+    mprint(HT_BATCH_ALLOC_END, allocated);
+    return allocated;
+}
+
+static int compare_addresses(const void * a, const void * b) {
+    unsigned long first = (unsigned long)*(void * const *)a;
+    unsigned long second = (unsigned long)*(void * const *)b;
+
+    return (first > second) - (first < second);
+}
+
+/**
+ * Frees 'count' allocations. The blocks are sorted by address so a run of neighbouring blocks is
+ * joined into one block first, and then merged and put in a bucket once
+ * @param heap
+ * @param addresses Allocations from this heap, NULL entries are skipped. Reordered in place
+ * @param count
+ */
+void half_free_batch_to(half_heap_t *heap, void ** addresses, U32 count){
+    U32 i;
+    U32 run_size;
+    block_header_t * first;
+    block_header_t * last;
+    block_header_t * next;
+
+    for (i = 0; i < count; i++) {
+        if (addresses[i]) {
+            count_add(heap, free_count, 1);
+            // slab slots are freed here and come back as NULL
+            addresses[i] = block_payload(heap, addresses[i]);
+        }
+    }
+    qsort(addresses, count, sizeof(void *), compare_addresses);
+    mprint(HT_BATCH_FREE_START, count);
+
+    lock_merge(heap);
+    i = 0;
+    while (i < count) {
+        if (addresses[i] == NULL) {
+            i++;
+            continue;
+        }
+        first = (block_header_t *)((U8 *)addresses[i] - HEADER_SIZE_BYTES);
+        last = first;
+        run_size = expand_block_size(first->block_size);
+        // extend the run while the next address is the block right after it
+        while (++i < count && (next = (block_header_t *)((U8 *)addresses[i] - HEADER_SIZE_BYTES))
+                == (block_header_t *)expand_address(heap, last->next_block, last)) {
+            merge_into(heap, next, first);
+            run_size += expand_block_size(next->block_size);
+            last = next;
+        }
+        if (last != first) {
+            first->block_size = shorten_block_size(run_size);
+            first->next_block = last->next_block == shorten_address(heap, last)
+                              ? shorten_address(heap, first) : last->next_block;
+        }
+        release_block(heap, first);
+    }
+    unlock_merge(heap);
+    mprint0(HT_BATCH_FREE_END);
+}
+
+/**
+ * Whether a free block is on a bucket list. Must be called holding the block's bucket lock
+ */
+static BOOL is_listed(half_heap_t *heap, block_header_t *block, U32 bucket_index) {
+    return heap->bucket_heads[bucket_index] == block || previous_in_bucket(heap, block) != NULL;
+}
+
+/**
+ * Checks that a free block is linked into the bucket its size belongs to, and that its bucket
+ * neighbours link back to it. Must be called holding the block's bucket lock
+ */
+static BOOL check_bucket_links(half_heap_t *heap, block_header_t *block, U32 bucket_index) {
+    block_header_t * previous = (block_header_t *)previous_in_bucket(heap, block);
+    block_header_t * next = (block_header_t *)next_in_bucket(heap, block);
+
+    if (!read_bucket_bit(heap, bucket_index)) {
+        return __FALSE;
+    }
+    if (previous == NULL) {
+        if (heap->bucket_heads[bucket_index] != block) {
+            return __FALSE;
+        }
+    } else if (previous->allocated
+            || (U32)get_bucket_index(expand_block_size(previous->block_size)) != bucket_index
+            || next_in_bucket(heap, previous) != block) {
+        return __FALSE;
+    }
+    if (next != NULL && (next->allocated || previous_in_bucket(heap, next) != block)) {
+        return __FALSE;
+    }
+    return __TRUE;
+}
+
+/**
+ * Checks the heap a few blocks at a time. Each call checks up to 'budget' blocks, starting where
+ * the last call stopped. After the last block of a region it goes on with the first block of the
+ * next region, and after the last region it starts over. For every block it checks the size and
+ * the links to its physical neighbours, that no two neighbours are free, and that a free block is
+ * on the list of the bucket its size belongs to. The bucket bit vector is checked against the
+ * bucket heads at the start of each sweep.
+ * Problems are reported through the trace, with offsets from the start of the block's region
+ * @param heap
+ * @param budget Blocks to check
+ * @return __FALSE if a problem was found
+ */
+BOOL  half_check_heap(half_heap_t *heap, U32 budget){
+    block_header_t * header;
+    block_header_t * next_block;
+    half_region_t * region;
+    U32 region_index;
+    U32 offset;
+    U32 block_size;
+    U32 bucket_index;
+    block_header_t block;
+    BOOL still_free;
+    BOOL ok = __TRUE;
+
+    lock_merge(heap);
+    // always a block start, merges move it to the block that absorbs the one it is on
+    header = (block_header_t *)heap->check_cursor;
+
+    while (budget-- > 0 && ok) {
+        region_index = region_of(heap, header);
+        region = &heap->regions[region_index];
+        offset = (U32)((U8 *)header - region->base);
+        if (offset == 0 && region_index == 0) {
+            for (bucket_index = 0; bucket_index < (U32)BUCKET_COUNT; bucket_index++) {
+                lock_bucket(heap, bucket_index);
+                if ((heap->bucket_heads[bucket_index] != NULL) != read_bucket_bit(heap, bucket_index)) {
+                    mprint(HT_CHECK_BAD_BIT_VECTOR, bucket_index);
+                    ok = __FALSE;
+                }
+                unlock_bucket(heap, bucket_index);
+            }
+#ifndef HALF_CONCURRENT
+            // in concurrent mode a first level bit may be caught while it is being updated
+            for (bucket_index = 0; bucket_index < fl_cnt; bucket_index++) {
+                if ((read_second_level(heap, bucket_index) != 0) != ((read_first_level(heap) >> bucket_index) & 1)) {
+                    mprint(HT_CHECK_BAD_BIT_VECTOR, bucket_index << sl_bits);
+                    ok = __FALSE;
+                }
+            }
+#endif
+        }
+
+        block = read_header(header);
+        block_size = expand_block_size(block.block_size);
+        if (offset + block_size > region->size) {
+            mprint2(HT_CHECK_BAD_SIZE, offset, block_size);
+            ok = __FALSE;
+            break;
+        }
+        next_block = (block_header_t *)expand_address(heap, block.next_block, header);
+        if (next_block ? (U8 *)next_block != (U8 *)header + block_size : offset + block_size != region->size) {
+            mprint(HT_CHECK_BAD_NEXT, offset);
+            ok = __FALSE;
+            break;
+        }
+        if (next_block && read_header(next_block).previous_block != (offset >> CHUNK_SIZE_POWER)) {
+            mprint(HT_CHECK_BAD_PREVIOUS, offset + block_size);
+            ok = __FALSE;
+        }
+
+        if (!block.allocated) {
+            bucket_index = (U32)get_bucket_index(block_size);
+            lock_bucket(heap, bucket_index);
+            // an allocation may have taken the block meanwhile, it marks it under this lock. Only
+            // frees, which wait for the merge lock, mark blocks free, so one still free was all along
+            still_free = !read_header(header).allocated;
+            if (still_free && (!is_listed(heap, header, bucket_index) || !check_bucket_links(heap, header, bucket_index))) {
+                mprint2(HT_CHECK_BAD_BUCKET_LINKS, offset, bucket_index);
+                ok = __FALSE;
+            }
+            unlock_bucket(heap, bucket_index);
+
+            // the block is read again after its neighbour, so both were free at the same time
+            if (still_free && next_block && !read_header(next_block).allocated && !read_header(header).allocated) {
+                mprint(HT_CHECK_ADJACENT_FREE, offset);
+                ok = __FALSE;
+            }
+        }
+
+        header = next_block ? next_block
+               : (block_header_t *)heap->regions[(region_index + 1) % heap->region_count].base;
+    }
+
+    heap->check_cursor = header;
+    unlock_merge(heap);
+    return ok;
+}
+
+/**
+ * Rebuilds the bucket lists, the bit vector and the free counts of a heap from its block headers,
+ * for a pool that outlived the program that used it, e.g. a file mapped again after a crash. Only
+ * the size and allocated fields are trusted. A split writes the new block's header before the size
+ * of the block it cuts, and a merge marks the block free before it writes the joined size, so
+ * wherever an update stopped the sizes still lead from the start of each region to its end. The
+ * neighbour links are written again from the sizes, and free neighbours are joined. The slab and
+ * quick lists are kept as they are. The heap must not be in use
+ * @param heap
+ * @return __FALSE if the sizes of a region do not add up to its size
+ */
+BOOL  half_rebuild_heap(half_heap_t *heap){
+    block_header_t * header;
+    block_header_t * previous;
+    half_region_t * region;
+    U32 region_index;
+    U32 offset;
+    U32 block_size;
+    U32 joined = 0;
+
+    clear_buckets(heap);
+#if defined(HALF_CONCURRENT) && defined(HALF_SLAB)
+    heap->slab_lock = 0;
+#endif
+#if defined(HALF_CONCURRENT) && defined(HALF_QUICK)
+    heap->quick_lock = 0;
+#endif
+#if defined(HALF_CONCURRENT) && defined(HALF_HANDLE)
+    heap->handle_lock = 0;
+#endif
+
+    for (region_index = 0; region_index < heap->region_count; region_index++) {
+        region = &heap->regions[region_index];
+        previous = NULL;
+        for (offset = 0; offset < region->size; offset += block_size) {
+            header = (block_header_t *)(region->base + offset);
+            block_size = expand_block_size(header->block_size);
+            if (offset + block_size > region->size) {
+                mprint2(HT_CHECK_BAD_SIZE, offset, block_size);
+                return __FALSE;
+            }
+            if (previous && !previous->allocated && !header->allocated) {
+                // a merge that stopped before the blocks were one
+                previous->block_size = shorten_block_size(expand_block_size(previous->block_size) + block_size);
+                joined++;
+                continue;
+            }
+            if (previous) {
+                previous->next_block = shorten_address(heap, header);
+                header->previous_block = shorten_address(heap, previous);
+                if (!previous->allocated) {
+                    add_to_known_bucket(heap, previous, (U32)get_bucket_index(expand_block_size(previous->block_size)));
+                }
+            } else {
+                header->previous_block = shorten_address(heap, header); // first block, point to null
+            }
+            previous = header;
+        }
+        previous->next_block = shorten_address(heap, previous); // last block, point to null
+        if (!previous->allocated) {
+            add_to_known_bucket(heap, previous, (U32)get_bucket_index(expand_block_size(previous->block_size)));
+        }
+    }
+
+    update_peak(heap);
+    mprint2(HT_REBUILD_END, count_read(heap, free_bytes), joined);
+    return __TRUE;
+}
+
+/**
+ * Copies the heap's counters without walking the heap. Each bucket is read under its lock, so the
+ * per bucket numbers are consistent with each other but not with allocations going on in other
+ * threads
+ * @param heap
+ * @param stats Receives the snapshot
+ */
+void  half_get_stats_of(half_heap_t *heap, struct half_stats * stats){
+    U32 i;
+
+    stats->heap_size = heap->total_size;
+    stats->free_bytes = count_read(heap, free_bytes);
+    stats->used_bytes = heap->total_size - stats->free_bytes;
+    lock_merge(heap);
+    stats->peak_used_bytes = count_read(heap, peak_used_bytes);
+    unlock_merge(heap);
+    stats->alloc_count = count_read(heap, alloc_count);
+    stats->failed_alloc_count = count_read(heap, failed_alloc_count);
+    stats->free_count = count_read(heap, free_count);
+
+    stats->largest_free_block = 0;
+    for (i = 0; i < BUCKET_COUNT; i++) {
+        lock_bucket(heap, i);
+        stats->bucket_free_bytes[i] = heap->bucket_free_bytes[i];
+        stats->bucket_free_blocks[i] = heap->bucket_free_blocks[i];
+        // every block of a bucket is larger than the blocks of the buckets below it
+        if (heap->bucket_free_blocks[i]) {
+            stats->largest_free_block = heap->bucket_largest[i];
+        }
+        unlock_bucket(heap, i);
+    }
+    // the buckets are read after free_bytes, other threads may have freed more meanwhile
+    stats->fragmentation_percent = stats->largest_free_block < stats->free_bytes
+        ? 100 - stats->largest_free_block * 100 / stats->free_bytes : 0;
+}
+
+/**
+ * Chooses how the heap picks free blocks, see half_fit_policy_t. HALF_FIT_ADDRESS orders a bucket as
+ * blocks are freed into it, so set it before the heap is used for the buckets to be in order, and
+ * before the heap is used by more than one thread in any case
+ * @param heap
+ * @param policy A half_fit_policy_t
+ * @param scan Most blocks HALF_FIT_BEST and HALF_FIT_ADDRESS look at, at least 1
+ */
+void  half_set_fit_policy_of(half_heap_t *heap, U32 policy, U32 scan){
+    heap->fit_policy = policy > HALF_FIT_ADDRESS ? HALF_FIT_HEAD : policy;
+    heap->fit_scan = scan > 0 ? scan : 1;
+}
+
+/**
+ * Grows a block into the next block if that one is free and large enough, and gives back the tail
+ * of a block that is 32 bytes or more larger than needed
+ * @param old_size Set to the bytes the block held before, read under the merge lock because the
+ *        neighbours rewrite the other fields of the header word
+ * @return __TRUE if the block now holds 'size' bytes
+ */
+static BOOL resize_block(half_heap_t *heap, void * address, U32 size, U32 *old_size) {
+    block_header_t * header = (block_header_t *)((U8 *)address - HEADER_SIZE_BYTES);
+    block_header_t * next_block;
+    block_header_t next_header;
+    U32 block_size;
+    U32 effective_size;
+
+    lock_merge(heap);
+    block_size = expand_block_size(header->block_size);
+    *old_size = block_size - HEADER_SIZE_BYTES;
+    if (size > heap->total_size) {
+        unlock_merge(heap);
+        return __FALSE;
+    }
+    effective_size = round_up_to_chunk_size(size+HEADER_SIZE_BYTES);
+    if (block_size < effective_size) {
+        next_block = (block_header_t *)expand_address(heap, header->next_block, header);
+        // the size of a free block only changes under the merge lock, so check it before claiming
+        if (next_block && (next_header = read_header(next_block), !next_header.allocated)
+                && block_size + expand_block_size(next_header.block_size) >= effective_size
+                && claim_free_block(heap, next_block)) {
+            mprint(HT_REALLOC_GROW, next_block);
+            merge_into(heap, next_block, header);
+            block_size += expand_block_size(next_block->block_size);
+            next_block = (block_header_t *)expand_address(heap, next_block->next_block, next_block);
+            if (next_block) {
+                header->next_block = shorten_address(heap, next_block);
+                next_block->previous_block = shorten_address(heap, header);
+            } else {
+                header->next_block = shorten_address(heap, header); // last block, point to null
+            }
+            header->block_size = shorten_block_size(block_size);
+        }
+    }
+    if (block_size >= effective_size + CHUNK_SIZE) {
+        split_block(heap, header, effective_size);
+    }
+    unlock_merge(heap);
+
+    return block_size >= effective_size;
+}
+
+/**
+ * Resizes an allocation, keeping its contents up to the smaller of the two sizes. A block grows in
+ * place into the next block if that one is free and large enough, and shrinks in place by giving
+ * its tail back. Only when neither works is the data copied to a new allocation
+ * @param heap
+ * @param address Allocation from this heap. NULL allocates
+ * @param size New size in bytes. 0 frees the allocation
+ * @return Pointer to the resized allocation, NULL if there is no room. The old allocation is left
+ *         untouched in that case
+ */
+void *half_realloc_in(half_heap_t *heap, void * address, U32 size){
+    U32 old_size;
+    void * new_address;
+
+    if (address == NULL) {
+        return half_alloc_from(heap, size);
+    }
+    if (size == 0) {
+        half_free_to(heap, address);
+        return NULL;
+    }
+    mprint2(HT_REALLOC_START, address, size);
+
+    if ((to_offset(heap, address) & (CHUNK_SIZE-1)) != HEADER_SIZE_BYTES) {
+        // slab slots and aligned payloads keep their address while the new size fits
+        old_size = offset_payload_size(heap, address);
+        if (old_size == 0) {
+            mprint(HT_BAD_ADDRESS, address);
+            return NULL;
+        }
+        if (size <= old_size) {
+            return address;
+        }
+    } else if (resize_block(heap, address, size, &old_size)) {
+        mprint0(HT_REALLOC_IN_PLACE);
+        return address;
+    }
+
+    new_address = half_alloc_from(heap, size);
+    if (new_address == NULL) {
+        return NULL;
+    }
+    memcpy(new_address, address, old_size < size ? old_size : size);
+    half_free_to(heap, address);
+    mprint0(HT_REALLOC_MOVED);
+    return new_address;
+}
+
+/**
+ * Allocates memory of 'size' bytes or greater whose address is a multiple of 'alignment'. Any
+ * chunks of the block before the aligned payload are given back as a free block, and so is the
+ * tail. Free the result with half_free as usual
+ * @param heap
+ * @param alignment A power of two. Up to 4 is what half_alloc gives anyway
+ * @param size
+ * @return Pointer, NULL if the heap has no room or the alignment is not a power of two
+ */
+void *half_memalign_from(half_heap_t *heap, U32 alignment, U32 size){
+    U8 * block_address;
+    U8 * aligned_address;
+    block_header_t * header;
+    block_header_t * aligned_header;
+    aligned_marker_t * marker;
+    U32 block_size;
+    U32 lead_size;
+    U32 effective_size;
+
+    if (alignment <= (U32)HEADER_SIZE_BYTES) {
+        return half_alloc_from(heap, size);
+    }
+    if ((alignment & (alignment - 1)) != 0 || alignment > heap->total_size || size > heap->total_size) {
+        mprint(HT_MEMALIGN_BAD_ALIGNMENT, alignment);
+        return NULL;
+    }
+    // the first aligned address is at most alignment - 4 bytes past the usual payload
+    block_address = (U8 *)allocate_block(heap, size + alignment - HEADER_SIZE_BYTES);
+    if (block_address == NULL && reclaim_blocks(heap)) {
+        block_address = (U8 *)allocate_block(heap, size + alignment - HEADER_SIZE_BYTES);
+    }
+    if (block_address == NULL) {
+        count_add(heap, failed_alloc_count, 1);
+        return NULL;
+    }
+    count_add(heap, alloc_count, 1);
+    block_address -= HEADER_SIZE_BYTES;
+    header = (block_header_t *)block_address;
+    mprint2(HT_MEMALIGN_START, block_address, alignment);
+
+    // payload addresses are multiples of 4, as are the aligned ones, so the payload is either where
+    // a block header puts it or 8 bytes or more into its chunk, with room for the marker
+    aligned_address = (U8 *)(((unsigned long)block_address + HEADER_SIZE_BYTES + alignment - 1) & ~(unsigned long)(alignment - 1));
+    lead_size = (to_offset(heap, aligned_address) - HEADER_SIZE_BYTES) & ~(U32)(CHUNK_SIZE-1);
+    lead_size -= to_offset(heap, block_address);
+    aligned_header = (block_header_t *)(block_address + lead_size);
+    effective_size = round_up_to_chunk_size((U32)(aligned_address - (U8 *)aligned_header) + size);
+
+    lock_merge(heap);
+    block_size = expand_block_size(header->block_size);
+    if (lead_size > 0) {
+        // the leading chunks become a block of their own, freed below
+        carve_block(heap, header, lead_size);
+        block_size -= lead_size;
+    }
+    if (block_size >= effective_size + CHUNK_SIZE) {
+        split_block(heap, aligned_header, effective_size);
+    }
+    unlock_merge(heap);
+
+    if (aligned_address != (U8 *)aligned_header + HEADER_SIZE_BYTES) {
+        marker = (aligned_marker_t *)(aligned_address - HEADER_SIZE_BYTES);
+        marker->block = shorten_address(heap, aligned_header);
+        marker->magic = aligned_magic;
+    }
+    if (lead_size > 0) {
+        // merges with a free previous block, like any other free
+        free_block(heap, block_address + HEADER_SIZE_BYTES);
+    }
+
+    mprint(HT_MEMALIGN_END, aligned_address);
+    return aligned_address;
+}
+
+/**
+ * Adds (direction 1) or takes away (direction -1) a free block in the bucket statistics.
+ * Must be called holding the bucket's lock. The size of a listed block only changes after it is
+ * taken off its list, under the same lock, so it can be read here even though a neighbour may be
+ * rewriting the link bits of the same header word.
+ * When the largest block leaves a bucket that still holds others, the size of the next largest is
+ * not known without walking the list. The mean block size, rounded down to a chunk, stands in for
+ * it until a larger block is added
+ */
+static void count_free_block(half_heap_t *heap, void * block_address, U32 bucket_index, S32 direction) {
+    U32 block_size = expand_block_size(((block_header_t *)block_address)->block_size);
+
+    heap->bucket_free_bytes[bucket_index] += (U32)direction * block_size;
+    heap->bucket_free_blocks[bucket_index] += (U32)direction;
+    count_add(heap, free_bytes, (U32)direction * block_size);
+
+    if (direction > 0) {
+        if (block_size > heap->bucket_largest[bucket_index]) {
+            heap->bucket_largest[bucket_index] = block_size;
+        }
+    } else if (heap->bucket_free_blocks[bucket_index] == 0) {
+        heap->bucket_largest[bucket_index] = 0;
+    } else if (block_size == heap->bucket_largest[bucket_index]) {
+        heap->bucket_largest[bucket_index] = heap->bucket_free_bytes[bucket_index]
+            / heap->bucket_free_blocks[bucket_index] >> CHUNK_SIZE_POWER << CHUNK_SIZE_POWER;
+    }
 }
 
 /**
@@ -203,154 +1739,175 @@ void  half_free(void * address){
  *
  * Warning: when you update this method, also update the remove_head_from_known_bucket_method
  */
-void remove_from_known_bucket(void * block_address, U32 bucket_index) {
+void remove_from_known_bucket(half_heap_t *heap, void * block_address, U32 bucket_index) {
     void * next_in_bucket_pointer;
     void * previous_in_bucket_pointer;
-    unused_block_header_t *next_header;
-    unused_block_header_t *previous_header;
-    unused_block_header_t *header = (unused_block_header_t*)((int)block_address+HEADER_SIZE);
 
-    if (block_address == bucket_heads[bucket_index]) {
-        mprint0("Address is a bucket head");
-        remove_head_from_known_bucket(block_address, bucket_index);
+    if (block_address == heap->bucket_heads[bucket_index]) {
+        mprint0(HT_REMOVE_IS_HEAD);
+        remove_head_from_known_bucket(heap, block_address, bucket_index);
         return;
     }
+    count_free_block(heap, block_address, bucket_index, -1);
 
-    mprint2("Removing address %d from bucket %d\n", block_address, bucket_index);
+    mprint2(HT_REMOVE_START, block_address, bucket_index);
 
-    next_in_bucket_pointer = expand_address(header->next_block, (U32)block_address);
-    previous_in_bucket_pointer = expand_address(header->previous_block, (U32)block_address);
+    next_in_bucket_pointer = next_in_bucket(heap, block_address);
+    previous_in_bucket_pointer = previous_in_bucket(heap, block_address);
 
     if (next_in_bucket_pointer) {
-        mprint("Updating next in bucket at address: %d\n", next_in_bucket_pointer);
-        next_header = (unused_block_header_t*)((int)next_in_bucket_pointer+HEADER_SIZE);
-        if (previous_in_bucket_pointer) {
-            next_header->previous_block = shorten_address(previous_in_bucket_pointer);
-        } else {
-            next_header->previous_block = header->next_block; // points to itself to indicate null
-        }
+        mprint(HT_UPDATE_NEXT_IN_BUCKET, next_in_bucket_pointer);
+        // points to itself to indicate null
+        set_previous_in_bucket(heap, next_in_bucket_pointer,
+                               previous_in_bucket_pointer ? previous_in_bucket_pointer : next_in_bucket_pointer);
     }
 
     if (previous_in_bucket_pointer) {
-        mprint("Updating previous in bucket at address: %d\n", previous_in_bucket_pointer);
-        previous_header = (unused_block_header_t*)((int)previous_in_bucket_pointer+HEADER_SIZE);
-        if (next_in_bucket_pointer) {
-            previous_header->next_block = shorten_address(next_in_bucket_pointer);
-        } else {
-            previous_header->next_block = header->previous_block; // points to itself to indicate null
-        }
+        mprint(HT_UPDATE_PREVIOUS_IN_BUCKET, previous_in_bucket_pointer);
+        // points to itself to indicate null
+        set_next_in_bucket(heap, previous_in_bucket_pointer,
+                           next_in_bucket_pointer ? next_in_bucket_pointer : previous_in_bucket_pointer);
     }
 
     if (!previous_in_bucket_pointer && !next_in_bucket_pointer) {
         // bucket is empty
-        mprint0("Bucket is empty\n");
-        bit_vector.buckets = bit_vector.buckets & !(1 << bucket_index);
+        mprint0(HT_BUCKET_EMPTY);
+        clear_bucket_bit(heap, bucket_index);
     }
+    // mark the block as off the list
+    set_previous_in_bucket(heap, block_address, block_address);
 }
 
 /**
  * Remove the given, currently unused block from the given bucket, given that the block is the head of the bucket.
  */
-void remove_head_from_known_bucket(void * block_address, U32 bucket_index) {
+void remove_head_from_known_bucket(half_heap_t *heap, void * block_address, U32 bucket_index) {
     void * next_in_bucket_pointer;
-    unused_block_header_t *next_header;
-    unused_block_header_t *header = (unused_block_header_t*)((int)block_address+HEADER_SIZE);
 
-    mprint2("Removing HEAD address %d from bucket %d\n", block_address, bucket_index);
-    if (block_address != bucket_heads[bucket_index]) {
-        mprint0("ERROR: block_address is not bucket head");
+    mprint2(HT_REMOVE_HEAD_START, block_address, bucket_index);
+    if (block_address != heap->bucket_heads[bucket_index]) {
+        mprint0(HT_REMOVE_HEAD_NOT_HEAD);
         return;
     }
 
-    next_in_bucket_pointer = expand_address(header->next_block, (U32)block_address);
+    next_in_bucket_pointer = next_in_bucket(heap, block_address);
 
     // could be null, or a valid pointer
-    bucket_heads[bucket_index] = next_in_bucket_pointer;
+    heap->bucket_heads[bucket_index] = next_in_bucket_pointer;
+    count_free_block(heap, block_address, bucket_index, -1);
 
     if (next_in_bucket_pointer) {
-        mprint("Updating next in bucket at address: %d\n", next_in_bucket_pointer);
-        next_header = (unused_block_header_t*)((int)next_in_bucket_pointer+HEADER_SIZE);
-        next_header->previous_block = header->next_block; // point to itself to indicate null;
+        mprint(HT_UPDATE_NEXT_IN_BUCKET, next_in_bucket_pointer);
+        set_previous_in_bucket(heap, next_in_bucket_pointer, next_in_bucket_pointer); // point to itself to indicate null
     } else {
         // bucket is empty
-        mprint0("Bucket is empty\n");
-        bit_vector.buckets = bit_vector.buckets & !(1 << bucket_index);
+        mprint0(HT_BUCKET_EMPTY);
+        clear_bucket_bit(heap, bucket_index);
     }
-    mprint0("Ending remove\n");
+    mprint0(HT_REMOVE_HEAD_END);
 }
 
-void add_to_known_bucket(void * address, U32 bucket_index) {
-    U32 short_address = shorten_address(address);
-    unused_block_header_t *this_header = (unused_block_header_t*)((int)address+HEADER_SIZE);
-
+void add_to_known_bucket(half_heap_t *heap, void * address, U32 bucket_index) {
     // updates pointers in header
-    void * next_address = bucket_heads[bucket_index];
-    mprint2("Adding address %d to bucket %d\n", address, bucket_index);
+    void * next_address = heap->bucket_heads[bucket_index];
+    void * previous_address;
+    mprint2(HT_ADD_START, address, bucket_index);
+    if (heap->fit_policy == HALF_FIT_ADDRESS && next_address && (unsigned long)next_address < (unsigned long)address) {
+        // after the last block below it, the bucket stays in address order
+        do {
+            previous_address = next_address;
+            next_address = next_in_bucket(heap, previous_address);
+        } while (next_address && (unsigned long)next_address < (unsigned long)address);
+
+        set_previous_in_bucket(heap, address, previous_address);
+        set_next_in_bucket(heap, address, next_address ? next_address : address);
+        if (next_address) {
+            set_previous_in_bucket(heap, next_address, address);
+        }
+        set_next_in_bucket(heap, previous_address, address);
+        count_free_block(heap, address, bucket_index, 1);
+        mprint0(HT_ADD_END);
+        return;
+    }
+    // the head has no previous block, so it points to itself
+    set_previous_in_bucket(heap, address, address);
     if (next_address) {
         // bucket has children
-        unused_block_header_t *next_header = (unused_block_header_t*)((int)next_address+HEADER_SIZE);
-        mprint("Next address is %d", next_address);
-        next_header->previous_block = short_address;
-        this_header->next_block = shorten_address(next_address);
-        // this_header->previous_block = short_address; // todo does it matter if previous block is set to null?
+        mprint(HT_ADD_NEXT, next_address);
+        set_previous_in_bucket(heap, next_address, address);
+        set_next_in_bucket(heap, address, next_address);
 
-        bucket_heads[bucket_index] = address;
+        heap->bucket_heads[bucket_index] = address;
     } else {
-        mprint("Next block is null, using short_address: %d\n", short_address);
-        bucket_heads[bucket_index] = address;
-        this_header->next_block = short_address; // set to null by setting to itself
+        mprint(HT_ADD_NEXT_NULL, shorten_address(heap, address));
+        heap->bucket_heads[bucket_index] = address;
+        set_next_in_bucket(heap, address, address); // set to null by setting to itself
     }
 
+    count_free_block(heap, address, bucket_index, 1);
     // update bit vector. Bucket is non empty
     // Put here for extra safety - it could also be put in the else branch
-    bit_vector.buckets = bit_vector.buckets | (1 << bucket_index);
-    mprint0("Done adding\n");
+    set_bucket_bit(heap, bucket_index);
+    mprint0(HT_ADD_END);
 }
 
 /**
- * Gives the index of the smallest bucket that has a memory block larger than the given size
+ * Gives the index of the smallest non empty bucket whose blocks all fit the given size.
+ * The first level bits at or above the guaranteed bucket's power of two are masked out, then the
+ * second level bits of the lowest one, so the cost does not depend on the size or on how many
+ * buckets are empty
+ * @param heap
  * @param size
- * @return
+ * @return -1 if no bucket has a block that is guaranteed to fit
  */
-signed int find_bucket(U32 size) {
+signed int find_bucket(half_heap_t *heap, U32 size) {
     signed int guaranteed_index = get_guaranteed_bucket(size);
+    U32 first_level;
+    U32 first_candidates;
+    U32 second_candidates;
 
     if (guaranteed_index == -1) {
         return guaranteed_index;
-    } else {
-        while((bit_vector.buckets & (1 << guaranteed_index)) == 0) {
-            guaranteed_index++;
-            if (guaranteed_index >= BUCKET_COUNT) {
-                return -1; // early return here, to stop an out of bounds exception later
-            }
+    }
+    first_level = (U32)guaranteed_index >> sl_bits;
+    second_candidates = read_second_level(heap, first_level) & (~0u << (guaranteed_index & (sl_cnt - 1)));
+    if (second_candidates == 0) {
+        // every bucket of a higher power of two fits
+        first_candidates = read_first_level(heap) & (~0u << (first_level + 1));
+        // only in concurrent mode can a first level bit be set with no bucket behind it
+        while (first_candidates && second_candidates == 0) {
+            first_level = half_lowest_bit(first_candidates);
+            second_candidates = read_second_level(heap, first_level);
+            first_candidates &= first_candidates - 1;
+        }
+        if (second_candidates == 0) {
+            return -1;
         }
-        return guaranteed_index;
     }
+    return (signed int)((first_level << sl_bits) + half_lowest_bit(second_candidates));
 }
 
 /**
- * Get the index for the bucket that contains the given size
+ * Get the index for the bucket that contains the given size. The first level is the power of two
+ * of the size in chunks, the second level which quarter of that power of two it falls in. Below
+ * 4 chunks a quarter is less than a chunk, so some of those buckets stay empty
  * @param size Size in bytes
  * @return index of the corresponding bucket. -1 if no bucket exists
  */
 signed int get_bucket_index(U32 size) {
-    int bucket_index;
-    int value;
+    // value is the number of 32 byte chunks that fit inside size
+    U32 value = size >> CHUNK_SIZE_POWER;
+    U32 first_level;
     if (size > MAX_SIZE) {
-        mprint("Size is greater than max size: %d\n", size);
+        mprint(HT_BUCKET_SIZE_TOO_LARGE, size);
         return -1;
     }
 
-    bucket_index = 0;
-    // value is initially the number of 32 byte chunks that fit inside size
-    value = size >> CHUNK_SIZE_POWER; // shift it right 5
-
-    // keep dividing by two until the value is 1. If the value is 0 or 1, never enter the while loop
-    while (value > 1) {
-        value = value >> 1;
-        bucket_index++;
-    }
-    return bucket_index;
+    // sizes under one chunk share bucket 0 with a single chunk
+    value += (value == 0);
+    first_level = half_log2_floor(value);
+    // the bits after the leading one, scaled to sl_bits bits
+    return (signed int)((first_level << sl_bits) + ((value << sl_bits) >> first_level) - sl_cnt);
 }
 
 /**
@@ -359,67 +1916,70 @@ signed int get_bucket_index(U32 size) {
  * @return index of the corresponding bucket. -1 if no bucket exists
  */
 signed int get_guaranteed_bucket(U32 size) {
-    int bucket_index;
-    int value;
-    int has_remainder;
+    U32 value;
+    U32 step;
     if (size > MAX_SIZE) {
         return -1;
     }
-    // examples
-    // 16 bytes -> bucket 0 (32-63 byte bucket)
-    // 32 bytes -> bucket 0
-    // 33 -> b1 (64-127 byte bucket)
-    // 63 -> b1
-    // 64 -> b1
-    // 65 -> b2 (127-255 byte bucket)
-    // 255 -> b2
-    // 256 -> b2
-    // 257 -> b3 (256-511)
+    // examples, in chunks
+    // 1 -> bucket 0 (1)
+    // 3 -> bucket 6 (3), below 4 chunks every size has its own bucket
+    // 8 -> bucket 12 (8-9)
+    // 9 -> bucket 13 (10-11), bucket 12 also holds blocks of 8
+    // 1023 -> bucket 40 (1024)
 
-    bucket_index = 0;
-    // value is initially the number of 32 byte chunks that fit inside size
-    value = size >> CHUNK_SIZE_POWER; // shift it right 5, i.e. divide it by 32
-    has_remainder = 0; // true if size is not a power of 2
+    // value is the number of 32 byte chunks needed to hold size
+    value = (size + CHUNK_SIZE - 1) >> CHUNK_SIZE_POWER;
+    value += (value == 0);
 
-    if ((size & 31) && value==1) {
-        has_remainder=1; // value is in 33-63 range
+    // round up to the smallest size of the next bucket, unless value already is one
+    step = (1u << half_log2_floor(value)) >> sl_bits;
+    value += step - (step > 0);
+    // past the last quarter of 512 chunks only a block of the whole heap is left
+    if (value > (U32)(MAX_SIZE >> CHUNK_SIZE_POWER)) {
+        value = MAX_SIZE >> CHUNK_SIZE_POWER;
     }
+    return get_bucket_index(value << CHUNK_SIZE_POWER);
+}
 
-    // keep dividing the value by two until it equals 1
-    while (value > 1) {
-        if ((size & 1) != 0) {
-            has_remainder = 1;
-        }
-        value = value >> 1;
-        bucket_index++;
-    }
-    if (has_remainder) {
-        // if there was a remainder, then we need the next bucket up to get a guaranteed fit
-        bucket_index += 1;
-    }
-    return bucket_index;
+/**
+ * Given a 10 bit 'pointer', convert it to an actual pointer in the region of the header it was
+ * read from. Requires the 'null pointer' value be provided. The null_pointer_value is the memory
+ * location of the header the pointer is being read from
+ */
+void * expand_address(half_heap_t *heap, U32 short_address, void * null_pointer_value) {
+    return expand_link(heap, region_of(heap, null_pointer_value), short_address, null_pointer_value);
 }
 
 /**
- * Given a 10 bit 'pointer', convert it to an actual pointer.
- * Requires the 'null pointer' value be provided. The null_pointer_value is the memory location of the header
- * the pointer is being read from
+ * Like expand_address, for a link that may point into another region than the header it was
+ * read from
  */
-void * expand_address(U32 short_address, U32 null_pointer_value) {
-    void * address = to_pointer((short_address << (CHUNK_SIZE_POWER + BYTES_TO_BIT_SHIFT)) + (int)memory_address);
-    if ((int)address == null_pointer_value) {
+void * expand_link(half_heap_t *heap, U32 region_index, U32 short_address, void * null_pointer_value) {
+    void * address = to_pointer(heap, region_index, short_address << CHUNK_SIZE_POWER);
+    if (address == null_pointer_value) {
         return NULL;
     } else {
         return address;
     }
 }
 
+/**
+ * Gives the 10 bit 'pointer' of an address, the chunk offset from the start of its region
+ */
+U32 shorten_address(half_heap_t *heap, void *address) {
+    half_region_t * region = &heap->regions[region_of(heap, address)];
 
-U32 shorten_address(void *address) {
-    if (address < memory_address) {
-        mprint0("ERROR: address is out of bounds\n");
+#ifdef HALF_DEBUG
+    if ((U8 *)address < region->base) {
+        mprint0(HT_ADDRESS_OUT_OF_BOUNDS);
     }
-    return (((unsigned int)address) - ((unsigned int)memory_address)) >> (CHUNK_SIZE_POWER + BYTES_TO_BIT_SHIFT);
+#endif
+    return (U32)((U8 *)address - region->base) >> CHUNK_SIZE_POWER;
+}
+
+U32 get_region_index(half_heap_t *heap, void *address) {
+    return region_of(heap, address);
 }
 
 U32 round_up_to_chunk_size(U32 value) {
@@ -445,12 +2005,14 @@ U32 expand_block_size(U32 short_size) {
  * @return
  */
 U32 shorten_block_size(U32 size) {
-    mprint("Shortening block size: %d\n", size);
+    mprint(HT_SHORTEN_SIZE, size);
+#ifdef HALF_DEBUG
     if ((size & 31) != 0) {
-        mprint("ERROR size is not a multiple of 32: %d", size);
+        mprint(HT_SHORTEN_SIZE_NOT_CHUNK, size);
     }
     if (size < 32) {
-        mprint0("ERROR size is less than chunk size");
+        mprint0(HT_SHORTEN_SIZE_TOO_SMALL);
     }
+#endif
     return (size >> CHUNK_SIZE_POWER) - 1;
 }
@@ -8,32 +8,58 @@
  */
 
 #include "type.h"
+#include "half_trace.h"
+#ifdef HALF_CONCURRENT
+#include "half_port.h"
+#endif
 
 #define smlst_blk                       5
 #define smlst_blk_sz  ( 1 << smlst_blk )   // 32
 #define lrgst_blk                       15 
 #define lrgst_blk_sz    ( 1 << lrgst_blk ) // 32768
+#define fl_cnt        ( lrgst_blk - smlst_blk + 1 ) // 11 powers of two of chunks, 1 to 1024
+#define sl_bits                         2
+#define sl_cnt           ( 1 << sl_bits )  // 4 linear sub classes per power of two
+#define bucket_cnt       ( fl_cnt * sl_cnt ) // 44, bucket fl * sl_cnt + sl
+#define slab_cls_cnt                    3   // slab slots of 8, 16 and 24 bytes
+#define slab_max_sz   ( slab_cls_cnt << 3 ) // 24, larger requests get a whole block
+#define quick_cnt                       8   // blocks of 1 to 8 chunks have quick lists
+#define region_bits                     2
+#define region_cnt     ( 1 << region_bits ) // 4, the first pool and up to 3 added with half_add_region
+#define handle_cnt                      64  // handles a heap can hand out at a time
+#define fit_scan_default                8   // blocks HALF_FIT_BEST and HALF_FIT_ADDRESS look at
 
- #define mprint0(str)  printf(str)
- #define mprint(str, arg1)  printf(str, arg1)
- #define mprint2(str, arg1, arg2)  printf(str, arg1, arg2)
- #define mprint3(str, arg1, arg2, arg3)  printf(str, arg1, arg2, arg3)
-//#define mprint0(str)  while(false){}
-//#define mprint(str, arg1)  while(false){}
-//#define mprint2(str, arg1, arg2)  while(false){}
-//#define mprint3(str, arg1, arg2, arg3)  while(false){}
-
+/**
+ * Bit sl of second_level[fl] is set if bucket fl * sl_cnt + sl is non empty, and bit fl of
+ * first_level if any bit of second_level[fl] is
+ */
 struct bit_vector_t {
-    unsigned int buckets : 11;
+#ifdef HALF_CONCURRENT
+    // updated with atomic or/and, buckets are locked independently. A first level bit may be
+    // stale for a moment while a bucket is filled or emptied, find_bucket skips one that is
+    // set for nothing and out_of_memory looks again under the merge lock
+    half_atomic_t first_level;
+    half_atomic_t second_level[fl_cnt];
+#else
+    unsigned int first_level : fl_cnt;
+    U8 second_level[fl_cnt];
+#endif
 };
 
+#ifdef HALF_CONCURRENT
+typedef half_atomic_t half_count_t;
+#else
+typedef U32 half_count_t;
+#endif
+
 /**
  * The header in all blocks. Points to the address of the adjacent blocks,
  * stores block size, and an allocated flag
  */
 typedef struct {
     // These pointers are considered null if they point to this block of memory
-    // to use the pointer, (pointer*32*8)+base_memory_address
+    // to use the pointer, (pointer*32)+base of the region the block is in. Neighbours are always
+    // in the same region
     unsigned int previous_block : 10;
     unsigned int next_block : 10;
     // The size of this block, including the header
@@ -44,27 +70,218 @@ typedef struct {
 } block_header_t;
 
 /**
- * points to the previous and next blocks in the bucket
+ * points to the previous and next blocks in the bucket. The bucket lists are shared by all regions
+ * of a heap, so each link also has the index of the region its short address is in
  */
 typedef struct {
     unsigned int previous_block : 10;
     unsigned int next_block : 10;
+    unsigned int previous_region : region_bits;
+    unsigned int next_region : region_bits;
 } unused_block_header_t;
 
+/**
+ * Sits in the 4 bytes right before a payload that half_memalign placed further into its block
+ * than the usual 4 bytes, so half_free can find the block header
+ */
+typedef struct {
+    // short address of the block holding the payload
+    unsigned int block : 10;
+    // always aligned_magic, tells a marker from payload data in a corrupt free
+    unsigned int magic : 22;
+} aligned_marker_t;
+
+#define aligned_magic              0x2A11C
+
+/**
+ * Where the block of a handle is, see half_handle.h
+ */
+typedef struct {
+    // short address of the block in region 'region'
+    unsigned int block : 10;
+    unsigned int region : region_bits;
+    // 1 while the handle is allocated
+    unsigned int used : 1;
+    // half_lock calls not undone by half_unlock yet, the block does not move while there are any
+    unsigned int pins : 8;
+} half_handle_entry_t;
+
+/**
+ * How a heap picks the free block for a request, see half_set_fit_policy_of
+ */
+typedef enum {
+    // the first block of the smallest bucket whose blocks all fit, in constant time
+    HALF_FIT_HEAD,
+    // the smallest block that fits among the first few of the bucket the size falls in, whose
+    // blocks may be too small. Otherwise as HALF_FIT_HEAD
+    HALF_FIT_BEST,
+    // every bucket is kept in address order, and the first block that fits among the first few of
+    // the bucket the size falls in is taken. Otherwise as HALF_FIT_HEAD, which then also takes the
+    // lowest block of its bucket. Freeing walks the bucket to keep the order
+    HALF_FIT_ADDRESS
+} half_fit_policy_t;
+
+/**
+ * A piece of memory that a heap hands out blocks from
+ */
+typedef struct {
+    U8 * base;
+    // a multiple of 32 and at most 32768
+    U32 size;
+} half_region_t;
+
+/**
+ * A self contained heap. Every link stored inside the pool is a 10 bit chunk offset from the base
+ * of a region, so each heap owns its free lists and bit vector and never touches another heap's
+ * memory. Blocks never span two regions, each region has its own chain of blocks, but the buckets
+ * and the bit vector are shared.
+ */
+typedef struct {
+    // first byte of the pool, must be 4 byte aligned. Also regions[0]
+    U8 * base;
+    // pool size in bytes, a multiple of 32 and at most 32768. Also regions[0]
+    U32 size;
+    // the pool and the regions added with half_add_region_to
+    half_region_t regions[region_cnt];
+    U32 region_count;
+    // bytes in all regions
+    U32 total_size;
+    // first free block of each bucket, NULL if the bucket is empty
+    void * bucket_heads[bucket_cnt];
+    // bit i is set if bucket i is non empty
+    struct bit_vector_t bit_vector;
+    // bytes and number of the free blocks in bucket i, kept with the bucket under its lock
+    U32 bucket_free_bytes[bucket_cnt];
+    U32 bucket_free_blocks[bucket_cnt];
+    // size of the largest free block in bucket i, see count_free_block. Under the bucket's lock
+    U32 bucket_largest[bucket_cnt];
+    // sum of bucket_free_bytes
+    half_count_t free_bytes;
+    // most bytes ever not free
+    half_count_t peak_used_bytes;
+    // calls that allocated, calls that found no room, and frees
+    half_count_t alloc_count;
+    half_count_t failed_alloc_count;
+    half_count_t free_count;
+    // block half_check looks at next
+    void * check_cursor;
+    // a half_fit_policy_t, and the most blocks it looks at in the bucket the size falls in
+    U32 fit_policy;
+    U32 fit_scan;
+#ifdef HALF_CONCURRENT
+    // bucket_locks[i] guards bucket_heads[i] and the links of the blocks in it
+    half_lock_t bucket_locks[bucket_cnt];
+    // guards the block headers, i.e. splitting and merging. An allocation marks the block it takes
+    // allocated under the bucket lock only
+    half_lock_t merge_lock;
+    // allocations that took a block off its list and have not put the remainder back yet
+    half_atomic_t in_flight;
+#endif
+#ifdef HALF_SLAB
+    // first block of a slab with free slots for each slot size, NULL if there is none
+    void * slab_partial[slab_cls_cnt];
+    // bit i of word i/32 of a region is set if a slab block starts at its chunk i
+    U32 slab_starts[region_cnt][32];
+#ifdef HALF_CONCURRENT
+    // guards the slab lists, the slab bitmaps and slab_starts
+    half_lock_t slab_lock;
+#endif
+#endif
+#ifdef HALF_QUICK
+    // most recently freed block of each size from 32 to 256 bytes, NULL if there is none
+    void * quick_heads[quick_cnt];
+    U32 quick_lengths[quick_cnt];
+#ifdef HALF_CONCURRENT
+    // guards the quick lists and the links of the blocks on them
+    half_lock_t quick_lock;
+#endif
+#endif
+#ifdef HALF_HANDLE
+    // the block of each handle, a handle is its index plus 1
+    half_handle_entry_t handles[handle_cnt];
+    // block half_compact looks at next
+    void * compact_cursor;
+#ifdef HALF_CONCURRENT
+    // guards the handle table. half_compact holds it while it moves blocks
+    half_lock_t handle_lock;
+#endif
+#endif
+} half_heap_t;
+
+/**
+ * A snapshot of a heap's counters, see half_get_stats
+ */
+typedef struct half_stats {
+    // bytes in all regions
+    U32 heap_size;
+    // bytes in allocated blocks, including block headers, slabs and blocks held by the thread cache
+    // or the quick lists
+    U32 used_bytes;
+    U32 free_bytes;
+    // most used_bytes since the heap was initialized
+    U32 peak_used_bytes;
+    // size of the largest free block, header included. Kept as blocks come and go, so once the
+    // largest block of the highest bucket is taken while smaller ones stay, this is a lower bound:
+    // the mean size of the blocks left in that bucket until a larger one is freed into it
+    U32 largest_free_block;
+    // 0 if all free memory is one block, towards 100 the more it is split up. Never 0 while more than
+    // one region has free memory
+    U32 fragmentation_percent;
+    // calls that reached the heap. With HALF_TCACHE, blocks the thread cache takes and hands out
+    // again are not counted, see half_tcache_get_stats
+    U32 alloc_count;
+    U32 failed_alloc_count;
+    U32 free_count;
+    U32 bucket_free_bytes[bucket_cnt];
+    U32 bucket_free_blocks[bucket_cnt];
+} half_stats_t;
+
+// The heap used by half_init, half_alloc and half_free
+extern half_heap_t half_default_heap;
+
 void  half_init( void );
+BOOL  half_add_region( void *, unsigned int );
 void *half_alloc( unsigned int );
 void  half_free( void * );
+void *half_realloc( void *, unsigned int );
+void *half_memalign( unsigned int, unsigned int );
+unsigned int half_alloc_batch( unsigned int, unsigned int, void ** );
+void  half_free_batch( void **, unsigned int );
+void  half_get_stats( struct half_stats * );
+BOOL  half_check( unsigned int );
+void  half_set_fit_policy( unsigned int, unsigned int );
+
+BOOL  half_init_heap( half_heap_t * heap, void * memory, U32 size );
+BOOL  half_add_region_to( half_heap_t * heap, void * memory, U32 size );
+void *half_alloc_from( half_heap_t * heap, U32 size );
+void  half_free_to( half_heap_t * heap, void * address );
+void *half_realloc_in( half_heap_t * heap, void * address, U32 size );
+void *half_memalign_from( half_heap_t * heap, U32 alignment, U32 size );
+U32   half_alloc_batch_from( half_heap_t * heap, U32 size, U32 count, void ** addresses );
+void  half_free_batch_to( half_heap_t * heap, void ** addresses, U32 count );
+void  half_get_stats_of( half_heap_t * heap, struct half_stats * stats );
+BOOL  half_check_heap( half_heap_t * heap, U32 budget );
+BOOL  half_rebuild_heap( half_heap_t * heap );
+void  half_set_fit_policy_of( half_heap_t * heap, U32 policy, U32 scan );
+
+void *allocate_block(half_heap_t * heap, U32 size);
+void  free_block(half_heap_t * heap, void * address);
+#ifdef HALF_HANDLE
+U32   compact_blocks(half_heap_t * heap, U32 budget);
+#endif
 
-signed int find_bucket(unsigned int size);
+signed int find_bucket(half_heap_t * heap, unsigned int size);
 signed int get_bucket_index(unsigned int size);
 signed int get_guaranteed_bucket(unsigned int size);
 
-void remove_head_from_known_bucket(void * block_address, U32 bucket_index);
-void remove_from_known_bucket(void * block_address, unsigned int bucket_index);
-void add_to_known_bucket(void * address, unsigned int bucket_index);
+void remove_head_from_known_bucket(half_heap_t * heap, void * block_address, U32 bucket_index);
+void remove_from_known_bucket(half_heap_t * heap, void * block_address, unsigned int bucket_index);
+void add_to_known_bucket(half_heap_t * heap, void * address, unsigned int bucket_index);
 
-unsigned int shorten_address(void * address);
-void * expand_address(unsigned int short_address, unsigned int null_pointer_value);
+unsigned int shorten_address(half_heap_t * heap, void * address);
+void * expand_address(half_heap_t * heap, unsigned int short_address, void * null_pointer_value);
+U32 get_region_index(half_heap_t * heap, void * address);
+void * expand_link(half_heap_t * heap, U32 region_index, U32 short_address, void * null_pointer_value);
 
 U32 expand_block_size(U32 short_size);
 U32 shorten_block_size(U32 size);
@@ -5,12 +5,29 @@
 ****************************************************************************/
 
 #include "half_fit.h"
+#include "half_capture.h"
+#include "half_latency.h"
+#include "half_persist.h"
+#ifdef HALF_HANDLE
+#include "half_handle.h"
+#endif
+#ifdef HALF_QUICK
+#include "half_quick.h"
+#endif
+#ifdef HALF_TCACHE
+#include "half_tcache.h"
+#endif
 #include "lpc17xx.h"
 #include <stdio.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include "uart.h"
+#if defined(HALF_PERSIST) && defined(LPC17XX_HOST)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 #define smlst_blk         5
 #define	smlst_blk_sz     (1 << smlst_blk)
@@ -541,6 +558,1036 @@ bool test_max_alc_1_byte( void ) {
 	return rslt;
 }
 
+// Reference size classes computed the slow way, one shift at a time: the power
+// of two of the size in chunks, then the quarter of it the size falls in
+int32_t ref_bucket_index( uint32_t size ) {
+	int32_t index = 0, quarter = 0;
+	uint32_t chunks = size >> smlst_blk;
+
+	if ( chunks == 0 ) {
+		chunks = 1;
+	}
+
+	while ( (2u << index) <= chunks ) {
+		index++;
+	}
+
+	while ( quarter < 3 && chunks * 4 >= (uint32_t)(5 + quarter) << index ) {
+		quarter++;
+	}
+
+	return index * 4 + quarter;
+}
+
+uint32_t ref_bucket_min_chunks( int32_t index ) {
+	uint32_t chunks = 1;
+	int32_t i;
+
+	for ( i = 0; i < index / 4; ++i ) {
+		chunks *= 2;
+	}
+
+	return chunks + chunks * (index % 4) / 4;
+}
+
+int32_t ref_guaranteed_bucket( uint32_t size ) {
+	int32_t index = 0;
+
+	while ( ref_bucket_min_chunks( index ) * smlst_blk_sz < size ) {
+		index++;
+	}
+
+	return index;
+}
+
+// Empties the bit vector, then marks buckets a and b (if below bucket_cnt) as non empty
+void set_buckets( half_heap_t *heap, uint32_t a, uint32_t b ) {
+	uint32_t i;
+
+	heap->bit_vector.first_level = 0;
+
+	for ( i = 0; i < fl_cnt; ++i ) {
+		heap->bit_vector.second_level[i] = 0;
+	}
+
+	for ( i = 0; i < bucket_cnt; ++i ) {
+		if ( i == a || i == b ) {
+			heap->bit_vector.second_level[i / sl_cnt] |= 1 << (i % sl_cnt);
+			heap->bit_vector.first_level |= 1 << (i / sl_cnt);
+		}
+	}
+}
+
+// Compares the constant time size class functions with the reference loops for every
+// size up to the largest block, and find_bucket for every bit vector with up to two
+// non empty buckets
+bool test_size_classes( void ) {
+	static uint8_t guaranteed[( lrgst_blk_sz >> smlst_blk ) + 1];
+	half_heap_t heap;
+	uint32_t size, chunks, a, b, expected;
+
+	for ( size = 1; size <= lrgst_blk_sz; ++size ) {
+		if ( get_bucket_index( size ) != ref_bucket_index( size )
+		  || get_guaranteed_bucket( size ) != ref_guaranteed_bucket( size ) ) {
+			#ifdef DO_PRINT
+				printf( "Size class mismatch for %d bytes\n", size );
+			#endif
+
+			return false;
+		}
+	}
+
+	if ( get_bucket_index( lrgst_blk_sz + 1 ) != -1 || get_guaranteed_bucket( lrgst_blk_sz + 1 ) != -1 ) {
+		return false;
+	}
+
+	for ( chunks = 1; chunks <= lrgst_blk_sz >> smlst_blk; ++chunks ) {
+		guaranteed[chunks] = (uint8_t)ref_guaranteed_bucket( chunks * smlst_blk_sz );
+	}
+
+	// b == bucket_cnt leaves only a, a == b == bucket_cnt leaves no bucket
+	for ( a = 0; a <= bucket_cnt; ++a ) {
+		for ( b = a; b <= bucket_cnt; ++b ) {
+			set_buckets( &heap, a, b );
+
+			for ( chunks = 1; chunks <= lrgst_blk_sz >> smlst_blk; ++chunks ) {
+				expected = a >= guaranteed[chunks] ? a : b >= guaranteed[chunks] ? b : bucket_cnt;
+
+				if ( find_bucket( &heap, chunks * smlst_blk_sz ) != (expected < bucket_cnt ? (int32_t)expected : -1) ) {
+					#ifdef DO_PRINT
+						printf( "find_bucket mismatch for %d chunks with buckets %d and %d\n", chunks, a, b );
+					#endif
+
+					return false;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+// Two heaps created with half_init_heap must not share any memory or free lists.
+// Filling the first heap must leave the second heap untouched
+bool test_independent_heaps( void ) {
+	static uint32_t pool_a[1024], pool_b[1024];
+	half_heap_t heap_a, heap_b;
+	void *ptr_a, *ptr_b;
+	uint32_t c = 0;
+
+	if ( !half_init_heap( &heap_a, pool_a, sizeof( pool_a ) ) || !half_init_heap( &heap_b, pool_b, sizeof( pool_b ) ) ) {
+		return false;
+	}
+
+	while ( (ptr_a = half_alloc_from( &heap_a, 1 )) != NULL ) {
+		if ( (char *)ptr_a < (char *)pool_a || (char *)ptr_a >= (char *)pool_a + sizeof( pool_a ) ) {
+			return false;
+		}
+		c++;
+	}
+
+	// heap_b still holds one block spanning its whole pool
+	ptr_b = half_alloc_from( &heap_b, sizeof( pool_b ) - 4 );
+
+	#ifdef DO_PRINT
+		printf( "%d 1-Byte blocks filled heap_a, heap_b block starts at %d\n", c, ptr_b );
+	#endif
+
+	if ( c == 0 || ptr_b == NULL ) {
+		return false;
+	}
+
+	half_free_to( &heap_b, ptr_b );
+
+	return true;
+}
+
+// Regions added with half_add_region_to share the buckets of the heap, but a
+// block must never reach past its region, and each region must merge back
+// into one free block. The gaps between the regions must stay untouched
+bool test_regions( void ) {
+	static uint32_t memory[1024];
+	unsigned char *pool = (unsigned char *)memory;
+	unsigned char *region_a = pool + 2048, *region_b = pool + 3584;
+	half_heap_t heap;
+	half_stats_t stats;
+	void *ptrs[128];
+	uint32_t i, c = 0, in_pool = 0, in_a = 0, in_b = 0;
+
+	memset( memory, 0xA5, sizeof( memory ) );
+
+	// 1 kB pool, a 1 kB gap, then 1 kB and 512 bytes with a 512 byte gap between
+	if ( !half_init_heap( &heap, pool, 1024 ) || !half_add_region_to( &heap, region_a, 1024 )
+	  || !half_add_region_to( &heap, region_b, 512 ) ) {
+		return false;
+	}
+
+	// overlapping, or at another place in a chunk than the pool
+	if ( half_add_region_to( &heap, region_a + 512, 1024 ) || half_add_region_to( &heap, pool + 1024 + 4, 512 ) ) {
+		return false;
+	}
+
+	half_get_stats_of( &heap, &stats );
+
+	if ( stats.heap_size != 2560 || stats.free_bytes != 2560 ) {
+		return false;
+	}
+
+	// a whole chunk each, too large for a slab slot
+	while ( c < 128 && (ptrs[c] = half_alloc_from( &heap, 28 )) != NULL ) {
+		if ( (unsigned char *)ptrs[c] < pool + 1024 ) {
+			in_pool++;
+		} else if ( (unsigned char *)ptrs[c] >= region_a && (unsigned char *)ptrs[c] < region_a + 1024 ) {
+			in_a++;
+		} else if ( (unsigned char *)ptrs[c] >= region_b && (unsigned char *)ptrs[c] < region_b + 512 ) {
+			in_b++;
+		} else {
+			return false;
+		}
+
+		c++;
+	}
+
+	#ifdef DO_PRINT
+		printf( "%d blocks, %d in the pool, %d in region a, %d in region b\n", c, in_pool, in_a, in_b );
+	#endif
+
+	if ( in_pool != 32 || in_a != 32 || in_b != 16 ) {
+		return false;
+	}
+
+	// every other block, so each bucket list runs through all three regions
+	for ( i = 0; i < c; i += 2 ) {
+		half_free_to( &heap, ptrs[i] );
+	}
+
+	if ( !half_check_heap( &heap, 2 * c ) ) {
+		return false;
+	}
+
+	for ( i = 1; i < c; i += 2 ) {
+		half_free_to( &heap, ptrs[i] );
+	}
+
+	#ifdef HALF_QUICK
+		half_quick_flush( &heap );
+	#endif
+
+	half_get_stats_of( &heap, &stats );
+
+	if ( !half_check_heap( &heap, 2 * c ) || stats.free_bytes != 2560 || stats.used_bytes != 0 ) {
+		return false;
+	}
+
+	for ( i = 0; i < 1024; ++i ) {
+		if ( pool[1024 + i] != 0xA5 || ( i < 512 && region_a[1024 + i] != 0xA5 ) ) {
+			return false;
+		}
+	}
+
+	// one block per region again
+	ptrs[0] = half_alloc_from( &heap, 1020 );
+	ptrs[1] = half_alloc_from( &heap, 1020 );
+	ptrs[2] = half_alloc_from( &heap, 508 );
+
+	return ptrs[0] != NULL && ptrs[1] != NULL && ptrs[2] != NULL && half_alloc_from( &heap, 1 ) == NULL;
+}
+
+// half_realloc must grow into a free neighbour and shrink without moving,
+// move only when the neighbour is taken, and keep the contents either way
+bool test_realloc( void ) {
+	size_t i, max_sz;
+	unsigned char *ptr_1, *ptr_2, *ptr_3;
+
+	half_init();
+	max_sz = find_max_block();
+
+	ptr_1 = half_alloc( 100 );
+	ptr_2 = half_alloc( 100 );
+
+	if ( ptr_1 == NULL || ptr_2 == NULL ) {
+		return false;
+	}
+
+	for ( i = 0; i < 100; ++i ) {
+		ptr_1[i] = (unsigned char)i;
+	}
+
+	half_free( ptr_2 );
+
+	#ifdef HALF_TCACHE
+		// cached blocks stay allocated in the heap, a flushed one may go on to a quick list
+		half_tcache_flush();
+	#endif
+	#ifdef HALF_QUICK
+		// merge the freed block now rather than on the next failed allocation
+		half_quick_flush( &half_default_heap );
+	#endif
+
+	// the next block is free, grow and shrink in place
+	if ( half_realloc( ptr_1, 1000 ) != ptr_1 || half_realloc( ptr_1, 40 ) != ptr_1 ) {
+		return false;
+	}
+
+	// the tail given back by the shrink is reused right behind ptr_1
+	ptr_2 = half_alloc( 100 );
+
+	if ( ptr_2 != ptr_1 + 64 ) {
+		#ifdef DO_PRINT
+			printf( "Shrunk tail was not reused: %d after %d\n", ptr_2, ptr_1 );
+		#endif
+
+		return false;
+	}
+
+	// the next block is taken, the data moves
+	ptr_3 = half_realloc( ptr_1, 200 );
+
+	if ( ptr_3 == NULL || ptr_3 == ptr_1 ) {
+		return false;
+	}
+
+	for ( i = 0; i < 40; ++i ) {
+		if ( ptr_3[i] != (unsigned char)i ) {
+			return false;
+		}
+	}
+
+	half_free( ptr_2 );
+	half_free( ptr_3 );
+
+	ptr_1 = half_alloc( max_sz );
+
+	if ( ptr_1 == NULL ) {
+		#ifdef DO_PRINT
+			printf( "Memory is defraged.\n" );
+		#endif
+
+		return false;
+	}
+
+	half_free( ptr_1 );
+
+	return true;
+}
+
+// half_memalign must return aligned, non overlapping blocks that plain half_free
+// takes back, and the leading chunks it skips must not be lost
+bool test_memalign( void ) {
+	block_t blks[RNDM_TESTS];
+	size_t i, max_sz, align;
+	void *ptr_1;
+
+	half_init();
+	max_sz = find_max_block();
+
+	for ( i = 0; i < RNDM_TESTS; ++i ) {
+		align = (size_t)8 << (rand() % 6);
+		blks[i].len = rand() % 200 + 1;
+		blks[i].ptr = half_memalign( align, blks[i].len );
+
+		if ( blks[i].ptr == NULL ) {
+			blks[i].len = 0;
+			continue;
+		}
+
+		if ( ((size_t)blks[i].ptr & (align - 1)) != 0 ) {
+			#ifdef DO_PRINT
+				printf( "%d is not aligned to %d\n", blks[i].ptr, align );
+			#endif
+
+			return false;
+		}
+
+		memset( blks[i].ptr, 0xAA, blks[i].len );
+	}
+
+	if ( is_violated( find_violation( blks, RNDM_TESTS ) ) ) {
+		return false;
+	}
+
+	for ( i = 0; i < RNDM_TESTS; ++i ) {
+		half_free( blks[i].ptr );
+	}
+
+	ptr_1 = half_alloc( max_sz );
+
+	if ( ptr_1 == NULL ) {
+		#ifdef DO_PRINT
+			printf( "Memory is defraged.\n" );
+		#endif
+
+		return false;
+	}
+
+	half_free( ptr_1 );
+
+	return true;
+}
+
+// A batch must hand out non overlapping blocks, stop cleanly when the heap is full,
+// and give every block back in one half_free_batch call
+bool test_batch_alc_free( void ) {
+	block_t blks[RNDM_TESTS << 2];
+	void *ptrs[RNDM_TESTS << 2];
+	size_t i, max_sz;
+	uint32_t c;
+	void *ptr_1;
+
+	half_init();
+	max_sz = find_max_block();
+
+	// more than the heap can hold
+	c = half_alloc_batch( 100, RNDM_TESTS << 2, ptrs );
+
+	#ifdef DO_PRINT
+		printf( "%d of %d 100-Byte blocks allocated in one batch.\n", c, RNDM_TESTS << 2 );
+	#endif
+
+	if ( c == 0 || c == RNDM_TESTS << 2 || half_alloc( 100 ) != NULL ) {
+		return false;
+	}
+
+	for ( i = 0; i < c; ++i ) {
+		blks[i].ptr = ptrs[i];
+		blks[i].len = 100;
+	}
+
+	if ( is_violated( find_violation( blks, c ) ) ) {
+		return false;
+	}
+
+	half_free_batch( ptrs, c );
+
+	ptr_1 = half_alloc( max_sz );
+
+	if ( ptr_1 == NULL ) {
+		#ifdef DO_PRINT
+			printf( "Memory is defraged.\n" );
+		#endif
+
+		return false;
+	}
+
+	half_free( ptr_1 );
+
+	return true;
+}
+
+// The statistics must follow allocations and frees without walking the heap:
+// used and free bytes add up, a hole in the middle shows up as fragmentation,
+// and the high water mark stays when everything is freed. Every extra region
+// is a free block of its own, so an empty heap only shows no fragmentation
+// when it has a single region
+bool test_stats( void ) {
+	half_stats_t stats;
+	void *ptr_1, *ptr_2, *ptr_3;
+	uint32_t i, bucket_sum = 0;
+	bool one_region;
+
+	half_init();
+	half_get_stats( &stats );
+	one_region = half_default_heap.region_count == 1;
+
+	if ( stats.used_bytes != 0 || stats.free_bytes != stats.heap_size || ( stats.fragmentation_percent == 0 ) != one_region ) {
+		return false;
+	}
+
+	ptr_1 = half_alloc( 1000 );
+	ptr_2 = half_alloc( 100 );
+	ptr_3 = half_alloc( 1000 );
+	half_free( ptr_2 );
+
+	#ifdef HALF_TCACHE
+		half_tcache_flush();
+	#endif
+	#ifdef HALF_QUICK
+		half_quick_flush( &half_default_heap );
+	#endif
+
+	half_get_stats( &stats );
+
+	for ( i = 0; i < bucket_cnt; ++i ) {
+		bucket_sum += stats.bucket_free_bytes[i];
+	}
+
+	#ifdef DO_PRINT
+		printf( "used %d, free %d, largest %d, fragmentation %d%%\n",
+		        stats.used_bytes, stats.free_bytes, stats.largest_free_block, stats.fragmentation_percent );
+	#endif
+
+	if ( stats.used_bytes != 2 * 1024 || bucket_sum != stats.free_bytes || stats.alloc_count != 3
+	  || stats.free_count != 1 || stats.bucket_free_blocks[get_bucket_index( 128 )] != 1 || stats.fragmentation_percent == 0
+	  || ( one_region && stats.largest_free_block != stats.free_bytes - 128 ) ) {
+		return false;
+	}
+
+	half_free( ptr_1 );
+	half_free( ptr_3 );
+	half_get_stats( &stats );
+
+	return stats.used_bytes == 0 && stats.peak_used_bytes == 2 * 1024 + 128 && ( stats.fragmentation_percent == 0 ) == one_region;
+}
+
+// half_check must pass a healthy heap one block per call, and find a broken
+// next_block link within one sweep
+bool test_check( void ) {
+	static uint32_t pool[1024];
+	half_heap_t heap;
+	block_header_t *header;
+	void *ptrs[8];
+	uint32_t i, saved;
+
+	if ( !half_init_heap( &heap, pool, sizeof( pool ) ) ) {
+		return false;
+	}
+
+	for ( i = 0; i < 8; ++i ) {
+		ptrs[i] = half_alloc_from( &heap, 100 * ( i + 1 ) );
+	}
+
+	for ( i = 0; i < 8; i += 2 ) {
+		half_free_to( &heap, ptrs[i] );
+	}
+
+	// 9 blocks, so 20 calls go round more than twice
+	for ( i = 0; i < 20; ++i ) {
+		if ( !half_check_heap( &heap, 1 ) ) {
+			return false;
+		}
+	}
+
+	header = (block_header_t *)( (char *)ptrs[3] - 4 );
+	saved = header->next_block;
+	header->next_block = saved + 1;
+
+	for ( i = 0; i < 10 && half_check_heap( &heap, 1 ); ++i ) {
+	}
+
+	header->next_block = saved;
+
+	#ifdef DO_PRINT
+		printf( "Broken link found after %d checks\n", i + 1 );
+	#endif
+
+	return i < 10 && half_check_heap( &heap, 10 );
+}
+
+// A free that stopped after marking its block free and writing the joined size,
+// before any links, must be finished by half_rebuild_heap from the sizes alone
+bool test_rebuild( void ) {
+	static uint32_t pool[1024];
+	half_heap_t heap;
+	block_header_t *header;
+	struct half_stats stats;
+	void *ptrs[4];
+	uint32_t i;
+
+	if ( !half_init_heap( &heap, pool, sizeof( pool ) ) ) {
+		return false;
+	}
+
+	// 320 byte blocks, too large for the quick lists
+	for ( i = 0; i < 4; ++i ) {
+		ptrs[i] = half_alloc_from( &heap, 300 );
+	}
+	half_free_to( &heap, ptrs[2] );
+
+	header = (block_header_t *)( (char *)ptrs[1] - 4 );
+	header->allocated = 0;
+	header->block_size = shorten_block_size( 640 );
+
+	if ( half_check_heap( &heap, 10 ) || !half_rebuild_heap( &heap ) ) {
+		return false;
+	}
+	half_get_stats_of( &heap, &stats );
+
+	#ifdef DO_PRINT
+		printf( "%d bytes free after the rebuild\n", stats.free_bytes );
+	#endif
+
+	return stats.free_bytes == sizeof( pool ) - 2 * 320 && half_check_heap( &heap, 10 )
+		&& half_alloc_from( &heap, 636 ) == ptrs[1];
+}
+
+// Freed blocks of 11, 10 and 11 chunks share a bucket that an 11 chunk request
+// only gets a block from if a policy looks into it. The default head pick
+// splits the large block at the end instead, best fit takes the exact block
+// that was freed last, and address order the lowest one
+bool test_fit_policies( void ) {
+	static uint32_t pool[1024];
+	half_heap_t heap;
+	void *ptrs[6], *ptr_1;
+	uint32_t policy, i;
+	bool rslt = true;
+
+	for ( policy = HALF_FIT_HEAD; policy <= HALF_FIT_ADDRESS; ++policy ) {
+		if ( !half_init_heap( &heap, pool, sizeof( pool ) ) ) {
+			return false;
+		}
+		half_set_fit_policy_of( &heap, policy, fit_scan_default );
+
+		// each block with a guard after it, so they do not merge when freed
+		for ( i = 0; i < 6; i += 2 ) {
+			ptrs[i] = half_alloc_from( &heap, i == 2 ? 316 : 348 );
+			ptrs[i + 1] = half_alloc_from( &heap, 60 );
+		}
+		for ( i = 0; i < 6; i += 2 ) {
+			half_free_to( &heap, ptrs[i] );
+		}
+
+		ptr_1 = half_alloc_from( &heap, 348 );
+
+		#ifdef DO_PRINT
+			printf( "Policy %d took the block at offset %d\n", policy, (char *)ptr_1 - (char *)pool );
+		#endif
+
+		if ( policy == HALF_FIT_HEAD ) {
+			rslt = rslt && (char *)ptr_1 > (char *)ptrs[5];
+		} else if ( policy == HALF_FIT_BEST ) {
+			rslt = rslt && ptr_1 == ptrs[4];
+		} else {
+			rslt = rslt && ptr_1 == ptrs[0];
+		}
+		rslt = rslt && half_check_heap( &heap, 20 );
+	}
+
+	return rslt;
+}
+
+#ifdef HALF_HANDLE
+// A heap with every other handle freed can not hand out a large block until
+// half_compact slides the rest down. The data moves with the blocks, and a
+// pinned handle stays where it is
+bool test_compact( void ) {
+	static uint32_t pool[1024];
+	half_heap_t heap;
+	half_handle_t handles[12];
+	unsigned char *data;
+	void *pinned;
+	uint32_t i, moved, calls;
+	bool rslt = true;
+
+	if ( !half_init_heap( &heap, pool, sizeof( pool ) ) ) {
+		return false;
+	}
+
+	// 320 byte blocks, 256 bytes are left at the end
+	for ( i = 0; i < 12; ++i ) {
+		handles[i] = half_halloc_from( &heap, 300 );
+		data = half_lock_in( &heap, handles[i] );
+		if ( data == NULL ) {
+			return false;
+		}
+		memset( data, (int)i, 300 );
+		half_unlock_in( &heap, handles[i] );
+	}
+	for ( i = 0; i < 12; i += 2 ) {
+		half_hfree_to( &heap, handles[i] );
+	}
+	pinned = half_lock_in( &heap, handles[9] );
+
+	if ( half_alloc_from( &heap, 1000 ) != NULL ) {
+		return false;
+	}
+
+	// blocks 1, 3, 5 and 7 go down, 11 closes up to the pinned 9
+	moved = 0;
+	for ( calls = 0; calls < 20; ++calls ) {
+		moved += half_compact_heap( &heap, 2 );
+	}
+
+	#ifdef DO_PRINT
+		printf( "%d blocks moved in %d calls\n", moved, calls );
+	#endif
+
+	for ( i = 1; i < 12; i += 2 ) {
+		data = half_lock_in( &heap, handles[i] );
+		if ( data == NULL || data[0] != i || data[299] != i ) {
+			rslt = false;
+		}
+		half_unlock_in( &heap, handles[i] );
+	}
+	data = half_alloc_from( &heap, 1000 );
+
+	rslt = rslt && moved == 5 && half_lock_in( &heap, handles[9] ) == pinned
+		&& data != NULL && half_check_heap( &heap, 20 );
+	half_free_to( &heap, data );
+	for ( i = 1; i < 12; i += 2 ) {
+		half_hfree_to( &heap, handles[i] );
+	}
+	return rslt && half_lock_in( &heap, handles[1] ) == NULL;
+}
+#endif
+
+#if defined(HALF_PERSIST) && defined(LPC17XX_HOST)
+// A heap image keeps its blocks and roots when it is closed and opened again,
+// and is rebuilt when the program that had it open stopped part way through
+// a free
+bool test_persist( void ) {
+	const char *path = "half_persist_test.img";
+	half_heap_t *heap;
+	struct half_stats stats;
+	char *ptr_1, *ptr_2;
+	pid_t child;
+	int status;
+	bool ok;
+
+	remove( path );
+	if ( ( heap = half_open_persistent( path, 8192 ) ) == NULL ) {
+		return false;
+	}
+	ptr_1 = half_alloc_from( heap, 1000 );
+	ptr_2 = half_alloc_from( heap, 500 );
+	memset( ptr_1, 0x5A, 1000 );
+	half_set_root( heap, 0, ptr_1 );
+	half_free_to( heap, ptr_2 );
+	half_close_persistent( heap );
+
+	// a program that stops with the image open, in the middle of a free
+	child = fork();
+	if ( child == 0 ) {
+		heap = half_open_persistent( path, 0 );
+		ptr_2 = heap ? half_alloc_from( heap, 500 ) : NULL;
+		if ( ptr_2 != NULL ) {
+			( (block_header_t *)( ptr_2 - 4 ) )->allocated = 0;
+		}
+		_exit( ptr_2 == NULL );
+	}
+	if ( child < 0 || waitpid( child, &status, 0 ) != child || status != 0 ) {
+		return false;
+	}
+
+	if ( ( heap = half_open_persistent( path, 0 ) ) == NULL ) {
+		return false;
+	}
+	ptr_1 = half_get_root( heap, 0 );
+	half_get_stats_of( heap, &stats );
+
+	#ifdef DO_PRINT
+		printf( "%d bytes used after reopening\n", stats.used_bytes );
+	#endif
+
+	ok = ptr_1 != NULL && ptr_1[0] == 0x5A && ptr_1[999] == 0x5A && half_get_root( heap, 1 ) == NULL
+		&& stats.used_bytes == 1024 && half_check_heap( heap, 10 );
+	half_close_persistent( heap );
+	remove( path );
+	return ok;
+}
+#endif
+
+#ifdef HALF_SLAB
+// Objects under 25 bytes come from slabs. They must not overlap, must pack at least
+// twice as densely as whole blocks, and must all return to the heap when freed
+bool test_slab_alc_free( void ) {
+	block_t blks[RNDM_TESTS];
+	size_t i, max_sz;
+	uint32_t c = 0;
+	void *ptr_1;
+
+	half_init();
+	max_sz = find_max_block();
+
+	for ( i = 0; i < RNDM_TESTS; ++i ) {
+		blks[i].len = rand() % slab_max_sz + 1;
+		blks[i].ptr = half_alloc( blks[i].len );
+
+		if ( blks[i].ptr == NULL ) {
+			return false;
+		}
+	}
+
+	if ( is_violated( find_violation( blks, RNDM_TESTS ) ) ) {
+		return false;
+	}
+
+	for ( i = 0; i < RNDM_TESTS; ++i ) {
+		half_free( blks[i].ptr );
+	}
+
+	ptr_1 = half_alloc( max_sz );
+
+	if ( ptr_1 == NULL ) {
+		#ifdef DO_PRINT
+			printf( "Memory is defraged.\n" );
+		#endif
+
+		return false;
+	}
+
+	half_free( ptr_1 );
+
+	while ( half_alloc( 8 ) != NULL ) {
+		c++;
+	}
+
+	#ifdef DO_PRINT
+		printf( "%d 8-Byte objects fit in %d Bytes.\n", c, max_sz );
+	#endif
+
+	return c >= 2 * (lrgst_blk_sz / smlst_blk_sz);
+}
+#endif
+
+#ifdef HALF_QUICK
+// A freed block comes straight back for the next request of its size without
+// being merged, and the blocks held on the quick lists are merged again as
+// soon as a large allocation needs them
+bool test_quick_alc_free( void ) {
+	block_t blks[RNDM_TESTS << 2];
+	size_t i, max_sz;
+	uint32_t c = 0;
+	void *ptr_1, *ptr_2;
+
+	half_init();
+	max_sz = find_max_block();
+
+	ptr_1 = half_alloc( 100 );
+	half_free( ptr_1 );
+
+	// merged back, it would be marked free. With a second region the whole heap is never one
+	// free block, so that cannot tell
+	if ( !( (block_header_t *)( (char *)ptr_1 - 4 ) )->allocated ) {
+		return false;
+	}
+
+	ptr_2 = half_alloc( 120 );
+
+	if ( ptr_2 != ptr_1 ) {
+		#ifdef DO_PRINT
+			printf( "Freed block was not reused: %d after %d\n", ptr_2, ptr_1 );
+		#endif
+
+		return false;
+	}
+
+	half_free( ptr_2 );
+
+	for ( i = 0; i < RNDM_TESTS << 2; ++i ) {
+		blks[i].len = ( rand() % 8 + 1 ) * 32 - 4;
+		blks[i].ptr = half_alloc( blks[i].len );
+
+		if ( blks[i].ptr == NULL ) {
+			break;
+		}
+
+		c++;
+	}
+
+	if ( is_violated( find_violation( blks, c ) ) ) {
+		return false;
+	}
+
+	for ( i = 0; i < c; ++i ) {
+		half_free( blks[i].ptr );
+	}
+
+	if ( !half_check( 1 << 10 ) ) {
+		return false;
+	}
+
+	ptr_1 = half_alloc( max_sz );
+
+	if ( ptr_1 == NULL ) {
+		#ifdef DO_PRINT
+			printf( "Memory is defraged.\n" );
+		#endif
+
+		return false;
+	}
+
+	half_free( ptr_1 );
+
+	return true;
+}
+#endif
+
+#if defined(HALF_CAPTURE) && defined(LPC17XX_HOST)
+// Every call to the default heap is captured in order, with the offsets it
+// handed out, and nothing is captured after half_capture_stop
+bool test_capture( void ) {
+	FILE *out = tmpfile();
+	half_capture_header_t header;
+	half_capture_record_t records[5];
+	void *ptr_1, *ptr_2, *ptr_3;
+	size_t c;
+
+	if ( out == NULL ) {
+		return false;
+	}
+
+	half_init();
+	half_capture_start( out );
+
+	ptr_1 = half_alloc( 100 );
+	ptr_2 = half_alloc( 200 );
+	half_free( ptr_1 );
+	ptr_3 = half_realloc( ptr_2, 300 );
+
+	half_capture_stop();
+	half_free( ptr_3 );
+
+	rewind( out );
+	c = fread( &header, sizeof( header ), 1, out );
+	c = c == 1 ? fread( records, sizeof( half_capture_record_t ), 5, out ) : 0;
+	fclose( out );
+
+	#ifdef DO_PRINT
+		printf( "%d records captured.\n", c );
+	#endif
+
+	return header.magic == half_capture_magic && c == 4
+		&& records[0].sequence == 0 && records[3].sequence == 3
+		&& records[0].op == HC_ALLOC && records[0].size == 100 && records[0].offset == half_capture_offset( ptr_1 )
+		&& records[1].op == HC_ALLOC && records[1].offset == half_capture_offset( ptr_2 )
+		&& records[2].op == HC_FREE && records[2].offset == half_capture_offset( ptr_1 )
+		&& records[3].op == HC_REALLOC && records[3].size == 300
+		&& records[3].offset == half_capture_offset( ptr_3 ) && records[3].argument == half_capture_offset( ptr_2 );
+}
+
+// A capture of a heap with a second region must record offsets below the
+// heap's total size, and replaying it on the same heap must hand out the same
+// offsets again, as host/half_replay.c does
+bool test_capture_regions( void ) {
+	static uint32_t memory[256];
+	FILE *out = tmpfile();
+	half_capture_header_t header;
+	half_capture_record_t records[96];
+	void *ptrs[64];
+	size_t c, i, j, n = 0, in_region = 0;
+	uint32_t init_size;
+
+	if ( out == NULL ) {
+		return false;
+	}
+
+	half_capture_start( out );
+	half_init();
+	init_size = half_default_heap.total_size;
+
+	// half_init adds one with HALF_AHB_REGION
+	if ( half_default_heap.region_count == 1 ) {
+		half_add_region( memory, sizeof( memory ) );
+	}
+
+	while ( n < 64 && (ptrs[n] = half_alloc( 1000 )) != NULL ) {
+		n++;
+	}
+
+	for ( i = 0; i < n; i += 2 ) {
+		half_free( ptrs[i] );
+	}
+
+	half_capture_stop();
+
+	rewind( out );
+	c = fread( &header, sizeof( header ), 1, out );
+	c = c == 1 ? fread( records, sizeof( half_capture_record_t ), 96, out ) : 0;
+	fclose( out );
+
+	#ifdef DO_PRINT
+		printf( "%d records captured from %d regions.\n", c, half_default_heap.region_count );
+	#endif
+
+	if ( c == 0 || c == 96 || records[0].op != HC_INIT || records[0].size != init_size ) {
+		return false;
+	}
+
+	half_init();
+
+	if ( half_default_heap.region_count == 1 ) {
+		half_add_region( memory, sizeof( memory ) );
+	}
+
+	for ( i = 1, n = 0; i < c; ++i ) {
+		if ( records[i].offset != half_capture_null && records[i].offset >= half_default_heap.total_size ) {
+			return false;
+		}
+
+		if ( records[i].op == HC_ALLOC ) {
+			ptrs[n] = half_alloc( records[i].size );
+
+			if ( half_capture_offset( ptrs[n] ) != records[i].offset ) {
+				return false;
+			}
+
+			if ( records[i].offset >= half_default_heap.size ) {
+				in_region++;
+			}
+
+			n++;
+		} else if ( records[i].op == HC_FREE ) {
+			for ( j = 0; j < n && half_capture_offset( ptrs[j] ) != records[i].offset; ++j ) {
+			}
+
+			if ( j == n ) {
+				return false;
+			}
+
+			half_free( ptrs[j] );
+			ptrs[j] = NULL;
+		}
+	}
+
+	for ( j = 0; j < n; ++j ) {
+		half_free( ptrs[j] );
+	}
+
+	return in_region > 0;
+}
+#endif
+
+#ifdef HALF_LATENCY
+// One alloc and free of a whole block take one sample of each operation, kept
+// as the maximum with the sizes and buckets they were taken for
+bool test_latency( void ) {
+	half_latency_t latency[HL_COUNT];
+	uint32_t op, i, c, split_size;
+	void *ptr_1;
+
+	half_latency_reset();
+	half_init();
+
+	// each region starts as one free block, the allocation splits the smallest
+	for ( i = 1, split_size = half_default_heap.size; i < half_default_heap.region_count; ++i ) {
+		if ( half_default_heap.regions[i].size < split_size ) {
+			split_size = half_default_heap.regions[i].size;
+		}
+	}
+
+	ptr_1 = half_alloc( 1000 );
+	half_free( ptr_1 );
+
+	for ( op = 0; op < HL_COUNT; ++op ) {
+		half_latency_get( op, &latency[op] );
+
+		for ( i = 0, c = 0; i < half_latency_bins; ++i ) {
+			c += latency[op].bins[i];
+		}
+
+		if ( latency[op].count != 1 || c != 1 || latency[op].total_cycles != latency[op].max_cycles ) {
+			#ifdef DO_PRINT
+				printf( "Operation %d has %d samples in %d bins.\n", op, latency[op].count, c );
+			#endif
+
+			return false;
+		}
+	}
+
+	if ( latency[HL_ALLOC].max_size != 1000 || latency[HL_ALLOC].max_bucket != get_guaranteed_bucket( 1024 )
+		|| latency[HL_FREE].max_size != 1024 || latency[HL_FREE].max_bucket != get_bucket_index( 1024 )
+		|| latency[HL_SPLIT].max_size != split_size || latency[HL_SPLIT].max_bucket != get_bucket_index( split_size )
+		|| latency[HL_COALESCE].max_size != 1024 ) {
+		return false;
+	}
+
+	half_latency_reset();
+	half_latency_get( HL_ALLOC, &latency[HL_ALLOC] );
+
+	return latency[HL_ALLOC].count == 0 && latency[HL_ALLOC].max_cycles == 0;
+}
+#endif
+
 bool test_max_alc_rand_byte( void ) {
 
 	return false;
@@ -555,15 +1602,48 @@ int main( void ) {
 	TimerInit();
 
 	TimerStart(); {
+#ifdef HALF_LATENCY
+		// first, so the report below has the samples of every test after it
+		printf( "***latency: %i\n",                   test_latency() );
+#endif
 // 		printf( "***max_alc: %i\n",                   test_max_alc() );
 // 		printf( "***alc_free_max: %i\n",              test_alc_free_max() );
 // 		printf( "***static_alc_free: %i\n",           test_static_alc_free() );
 // 		printf( "***static_alc_free_violation: %i\n", test_static_alc_free_violation() );
  		printf( "***rndm_alc_free: %i\n",             test_rndm_alc_free() );
 		printf( "***max_alc_1_byte: %i\n",            test_max_alc_1_byte() );
+		printf( "***independent_heaps: %i\n",         test_independent_heaps() );
+		printf( "***regions: %i\n",                   test_regions() );
+		printf( "***size_classes: %i\n",              test_size_classes() );
+		printf( "***realloc: %i\n",                   test_realloc() );
+		printf( "***memalign: %i\n",                  test_memalign() );
+		printf( "***batch_alc_free: %i\n",            test_batch_alc_free() );
+		printf( "***stats: %i\n",                     test_stats() );
+		printf( "***check: %i\n",                     test_check() );
+		printf( "***rebuild: %i\n",                   test_rebuild() );
+		printf( "***fit_policies: %i\n",              test_fit_policies() );
+#ifdef HALF_SLAB
+		printf( "***slab_alc_free: %i\n",             test_slab_alc_free() );
+#endif
+#ifdef HALF_QUICK
+		printf( "***quick_alc_free: %i\n",            test_quick_alc_free() );
+#endif
+#if defined(HALF_CAPTURE) && defined(LPC17XX_HOST)
+		printf( "***capture: %i\n",                   test_capture() );
+		printf( "***capture_regions: %i\n",           test_capture_regions() );
+#endif
+#ifdef HALF_HANDLE
+		printf( "***compact: %i\n",                   test_compact() );
+#endif
+#if defined(HALF_PERSIST) && defined(LPC17XX_HOST)
+		printf( "***persist: %i\n",                   test_persist() );
+#endif
 	} TimerStop();
 	
 	printf( "The elappsed time:              %d ms\n", current_elapsed_time());
+#ifdef HALF_LATENCY
+	half_latency_print( stdout );
+#endif
 	
 	while( 1 ) {
 		// Infinite loop
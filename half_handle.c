@@ -0,0 +1,176 @@
+#include "half_handle.h"
+#include "half_port.h"
+#ifdef HALF_QUICK
+#include "half_quick.h"
+#endif
+
+#ifdef HALF_HANDLE
+
+#ifdef HALF_CONCURRENT
+#define lock_handles(heap)    half_lock_acquire(&(heap)->handle_lock)
+#define unlock_handles(heap)  half_lock_release(&(heap)->handle_lock)
+#else
+#define lock_handles(heap)
+#define unlock_handles(heap)
+#endif
+
+/**
+ * The entry of a handle, NULL if it is not allocated
+ */
+static __inline half_handle_entry_t * entry_of(half_heap_t * heap, half_handle_t handle) {
+    if (handle == 0 || handle > handle_cnt || !heap->handles[handle - 1].used) {
+        return NULL;
+    }
+    return &heap->handles[handle - 1];
+}
+
+/**
+ * Payload of the block a handle's entry points to
+ */
+static __inline U8 * entry_payload(half_heap_t * heap, half_handle_entry_t * entry) {
+    return (U8 *)expand_link(heap, entry->region, entry->block, NULL) + sizeof(block_header_t);
+}
+
+half_handle_t half_halloc(U32 size) {
+    return half_halloc_from(&half_default_heap, size);
+}
+
+void half_hfree(half_handle_t handle) {
+    half_hfree_to(&half_default_heap, handle);
+}
+
+void *half_lock(half_handle_t handle) {
+    return half_lock_in(&half_default_heap, handle);
+}
+
+void half_unlock(half_handle_t handle) {
+    half_unlock_in(&half_default_heap, handle);
+}
+
+U32 half_compact(U32 budget) {
+    return half_compact_heap(&half_default_heap, budget);
+}
+
+void half_handle_init(half_heap_t * heap) {
+    U32 i;
+
+    for (i = 0; i < handle_cnt; i++) {
+        heap->handles[i].used = 0;
+        heap->handles[i].pins = 0;
+    }
+    heap->compact_cursor = heap->base;
+#ifdef HALF_CONCURRENT
+    heap->handle_lock = 0;
+#endif
+}
+
+half_handle_t half_halloc_from(half_heap_t * heap, U32 size) {
+    half_handle_entry_t * entry = NULL;
+    U8 * payload;
+    U32 i;
+
+    lock_handles(heap);
+    for (i = 0; i < handle_cnt; i++) {
+        if (!heap->handles[i].used) {
+            entry = &heap->handles[i];
+            // pinned until it points to its block, so half_compact leaves it alone
+            entry->used = 1;
+            entry->pins = 1;
+            break;
+        }
+    }
+    unlock_handles(heap);
+    if (entry == NULL) {
+        return 0;
+    }
+
+    // always a whole block, never a slab slot
+    payload = (U8 *)half_alloc_from(heap, size > slab_max_sz ? size : slab_max_sz + 1);
+
+    lock_handles(heap);
+    if (payload == NULL) {
+        entry->used = 0;
+    } else {
+        half_handle_moved(heap, entry, payload);
+    }
+    entry->pins = 0;
+    unlock_handles(heap);
+    return payload ? i + 1 : 0;
+}
+
+void half_hfree_to(half_heap_t * heap, half_handle_t handle) {
+    half_handle_entry_t * entry;
+    U8 * payload = NULL;
+
+    lock_handles(heap);
+    entry = entry_of(heap, handle);
+    if (entry) {
+        payload = entry_payload(heap, entry);
+        entry->used = 0;
+        entry->pins = 0;
+    }
+    unlock_handles(heap);
+    half_free_to(heap, payload);
+}
+
+void *half_lock_in(half_heap_t * heap, half_handle_t handle) {
+    half_handle_entry_t * entry;
+    U8 * data = NULL;
+
+    lock_handles(heap);
+    entry = entry_of(heap, handle);
+    if (entry && entry->pins < 255) {
+        entry->pins++;
+        data = entry_payload(heap, entry);
+    }
+    unlock_handles(heap);
+    return data;
+}
+
+void half_unlock_in(half_heap_t * heap, half_handle_t handle) {
+    half_handle_entry_t * entry;
+
+    lock_handles(heap);
+    entry = entry_of(heap, handle);
+    if (entry && entry->pins > 0) {
+        entry->pins--;
+    }
+    unlock_handles(heap);
+}
+
+U32 half_compact_heap(half_heap_t * heap, U32 budget) {
+    U32 moved;
+
+#ifdef HALF_QUICK
+    // blocks on the quick lists stay allocated and would hold their space where it is
+    half_quick_flush(heap);
+#endif
+    lock_handles(heap);
+    moved = compact_blocks(heap, budget);
+    unlock_handles(heap);
+    return moved;
+}
+
+half_handle_entry_t * half_handle_movable(half_heap_t * heap, void * payload) {
+    void * block = (U8 *)payload - sizeof(block_header_t);
+    U32 short_address = shorten_address(heap, block);
+    U32 region_index = get_region_index(heap, block);
+    half_handle_entry_t * entry;
+
+    // the table, not the payload, tells a handle's block from others, whose data may be changing
+    for (entry = heap->handles; entry < heap->handles + handle_cnt; entry++) {
+        if (entry->used && entry->block == short_address && entry->region == region_index) {
+            return entry->pins == 0 ? entry : NULL;
+        }
+    }
+    return NULL;
+}
+
+void half_handle_moved(half_heap_t * heap, half_handle_entry_t * entry, void * payload) {
+    void * block = (U8 *)payload - sizeof(block_header_t);
+
+    entry->block = shorten_address(heap, block);
+    entry->region = get_region_index(heap, block);
+}
+
+#endif /* HALF_HANDLE */
@@ -0,0 +1,45 @@
+#ifndef HALF_HANDLE_H_
+#define HALF_HANDLE_H_
+
+/*
+ * Relocatable allocations, compiled in with HALF_HANDLE.
+ *
+ * half_halloc hands out a handle instead of an address. The memory is only reached between
+ * half_lock, which pins the block and gives its current address, and half_unlock. half_compact
+ * slides blocks of unpinned handles down into the free block before them, so the free space
+ * gathers into large blocks at the end of each region after enough calls. A heap that random
+ * allocations and frees left too cut up for a large request can get it back without a restart.
+ *
+ * Blocks of plain allocations, slabs and pinned handles are not moved, free space only gathers
+ * between them. The quick lists are given back to the heap on each half_compact. Moving a block
+ * is not crash safe in a persistent heap.
+ */
+
+#include "half_fit.h"
+
+// 0 is never a handle
+typedef U32 half_handle_t;
+
+half_handle_t half_halloc( U32 size );
+void          half_hfree( half_handle_t handle );
+void *        half_lock( half_handle_t handle );
+void          half_unlock( half_handle_t handle );
+U32           half_compact( U32 budget );
+
+void          half_handle_init( half_heap_t * heap );
+// Allocates 'size' bytes that half_compact may move. 0 if there is no room or no free handle
+half_handle_t half_halloc_from( half_heap_t * heap, U32 size );
+void          half_hfree_to( half_heap_t * heap, half_handle_t handle );
+// Pins the handle's block and returns the address of its data, NULL for a handle not allocated
+void *        half_lock_in( half_heap_t * heap, half_handle_t handle );
+void          half_unlock_in( half_heap_t * heap, half_handle_t handle );
+// Looks at up to 'budget' blocks, starting where the last call stopped, and moves every unpinned
+// handle block that has a free block before it. Returns the number of blocks moved
+U32           half_compact_heap( half_heap_t * heap, U32 budget );
+
+// For compact_blocks, holding the handle and merge locks. The entry of the handle whose data
+// follows 'payload', NULL if there is none or it is pinned
+half_handle_entry_t * half_handle_movable( half_heap_t * heap, void * payload );
+void          half_handle_moved( half_heap_t * heap, half_handle_entry_t * entry, void * payload );
+
+#endif
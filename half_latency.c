@@ -0,0 +1,99 @@
+
+#include "half_latency.h"
+#include "half_fit.h"
+#include "half_port.h"
+
+#ifdef HALF_LATENCY
+
+#ifdef HALF_CONCURRENT
+static half_lock_t latency_lock;
+#define lock_latency()    half_lock_acquire(&latency_lock)
+#define unlock_latency()  half_lock_release(&latency_lock)
+#else
+#define lock_latency()
+#define unlock_latency()
+#endif
+
+static half_latency_t latencies[HL_COUNT];
+
+static const char * const op_names[HL_COUNT] = {
+    "alloc", "free", "split", "coalesce"
+};
+
+/**
+ * The bucket a sample was taken for, only worked out for a new maximum
+ */
+static S32 sample_bucket(U32 op, U32 size) {
+    if (size == 0 || size > lrgst_blk_sz) {
+        return -1;
+    }
+    if (op == HL_ALLOC) {
+        return size > lrgst_blk_sz - sizeof(block_header_t) ? -1
+             : get_guaranteed_bucket(round_up_to_chunk_size(size + sizeof(block_header_t)));
+    }
+    return get_bucket_index(size);
+}
+
+void half_latency(U32 op, U32 start, U32 size) {
+    U32 cycles = half_cycles() - start;
+    half_latency_t * latency = &latencies[op];
+    BOOL new_max;
+
+    lock_latency();
+    latency->count++;
+    latency->total_cycles += cycles;
+    latency->bins[cycles ? half_log2_floor(cycles) : 0]++;
+    new_max = cycles > latency->max_cycles || latency->count == 1;
+    if (new_max) {
+        latency->max_cycles = cycles;
+        latency->max_size = size;
+        latency->max_bucket = sample_bucket(op, size);
+    }
+    unlock_latency();
+}
+
+void half_latency_get(U32 op, half_latency_t * latency) {
+    lock_latency();
+    *latency = latencies[op];
+    unlock_latency();
+}
+
+void half_latency_reset(void) {
+    U32 op, i;
+
+    lock_latency();
+    for (op = 0; op < HL_COUNT; op++) {
+        latencies[op].count = 0;
+        latencies[op].total_cycles = 0;
+        latencies[op].max_cycles = 0;
+        latencies[op].max_size = 0;
+        latencies[op].max_bucket = -1;
+        for (i = 0; i < half_latency_bins; i++) {
+            latencies[op].bins[i] = 0;
+        }
+    }
+    unlock_latency();
+}
+
+void half_latency_print(FILE * out) {
+    half_latency_t latency;
+    U32 op, i;
+
+    fprintf(out, "%-9s %9s %10s %10s %8s %7s\n", "op", "count", "mean", "max", "max size", "bucket");
+    for (op = 0; op < HL_COUNT; op++) {
+        half_latency_get(op, &latency);
+        if (latency.count == 0) {
+            continue;
+        }
+        fprintf(out, "%-9s %9u %10u %10u %8u %7d\n", op_names[op], latency.count,
+                (U32)(latency.total_cycles / latency.count), latency.max_cycles, latency.max_size,
+                latency.max_bucket);
+        for (i = 0; i < half_latency_bins; i++) {
+            if (latency.bins[i]) {
+                fprintf(out, "    %10u to %10u cycles: %u\n", i ? 1u << i : 0, (2u << i) - 1, latency.bins[i]);
+            }
+        }
+    }
+}
+
+#endif /* HALF_LATENCY */
@@ -0,0 +1,64 @@
+#ifndef HALF_LATENCY_H_
+#define HALF_LATENCY_H_
+
+/*
+ * Cycle counts of the allocator's operations, compiled in with HALF_LATENCY.
+ *
+ * half_alloc, half_free, and the block splits and merges inside them are timed with half_cycles(),
+ * the DWT cycle counter on the Cortex-M3 and the time stamp counter on a host. Every sample goes
+ * into a histogram of its operation with one bin per power of two of cycles. The longest sample
+ * of each operation is kept with the size and bucket it was taken for, so a worst case can be
+ * traced back to the request that caused it.
+ *
+ * The samples of all heaps are added up. Nested operations are timed each on their own: a split
+ * is counted in HL_SPLIT and is also part of the half_alloc around it.
+ */
+
+#include "type.h"
+#include <stdio.h>
+
+#define half_latency_bins  32 // bin i counts samples of 2^i to 2^(i+1)-1 cycles, bin 0 also 0
+
+typedef enum {
+    // half_alloc, also when half_realloc moves a block. Size is the request in bytes, bucket the
+    // one the search for a block starts at
+    HL_ALLOC,
+    // half_free. Size is the block in bytes, header included, 0 for a slab slot
+    HL_FREE,
+    // a block cut to size. Size is the block before the cut
+    HL_SPLIT,
+    // a block freed and merged with its free neighbours. Size is the block before merging
+    HL_COALESCE,
+    HL_COUNT
+} half_latency_op_t;
+
+typedef struct {
+    U32 count;
+    U64 total_cycles;
+    U32 max_cycles;
+    // size and bucket of the sample that took max_cycles, bucket is -1 if it has none
+    U32 max_size;
+    S32 max_bucket;
+    U32 bins[half_latency_bins];
+} half_latency_t;
+
+#ifdef HALF_LATENCY
+
+// Timestamp to pass to half_latency as 'start'
+#define half_latency_start()  half_cycles()
+
+// Adds a sample of half_cycles() - start to the histogram of 'op'
+void half_latency( U32 op, U32 start, U32 size );
+// Copies the samples of 'op' so far
+void half_latency_get( U32 op, half_latency_t * latency );
+void half_latency_reset( void );
+// Writes every operation's count, mean, maximum and non empty bins as text
+void half_latency_print( FILE * out );
+
+#else
+
+#define half_latency(op, start, size)  ((void)0)
+
+#endif
+
+#endif
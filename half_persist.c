@@ -0,0 +1,233 @@
+#include "half_persist.h"
+#include "half_fit.h"
+
+#ifdef HALF_PERSIST
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static __inline half_image_t * image_of(half_heap_t * heap) {
+    return (half_image_t *)((U8 *)heap - offsetof(half_image_t, heap));
+}
+
+static __inline U32 image_size(half_image_t * image) {
+    return image->pool_offset + image->pool_size;
+}
+
+/**
+ * The pool starts on the first page after the image header, so it is aligned like memory_pool
+ * up to the page size and aligned allocations land on the same offsets
+ */
+static U32 pool_offset(void) {
+    U32 page_size = (U32)sysconf(_SC_PAGESIZE);
+
+    return ((U32)sizeof(half_image_t) + page_size - 1) & ~(page_size - 1);
+}
+
+/**
+ * Moves a pointer of the heap header to where the pool is mapped now
+ */
+static void * rebase(void * pointer, unsigned long old_pool, unsigned long new_pool) {
+    return pointer ? (void *)((unsigned long)pointer - old_pool + new_pool) : NULL;
+}
+
+static __inline BOOL in_pool(half_heap_t * heap, void * pointer) {
+    return pointer == NULL || ((U8 *)pointer >= heap->base && (U8 *)pointer < heap->base + heap->size);
+}
+
+/**
+ * Whether the list heads lie in the pool, half_check_heap follows the links from them
+ */
+static BOOL heads_in_pool(half_heap_t * heap) {
+    U32 i;
+
+    for (i = 0; i < bucket_cnt; i++) {
+        if (!in_pool(heap, heap->bucket_heads[i])) {
+            return __FALSE;
+        }
+    }
+#ifdef HALF_SLAB
+    for (i = 0; i < slab_cls_cnt; i++) {
+        if (!in_pool(heap, heap->slab_partial[i])) {
+            return __FALSE;
+        }
+    }
+#endif
+#ifdef HALF_QUICK
+    for (i = 0; i < quick_cnt; i++) {
+        if (!in_pool(heap, heap->quick_heads[i])) {
+            return __FALSE;
+        }
+    }
+#endif
+    return __TRUE;
+}
+
+/**
+ * Sets up a new image in an empty file
+ */
+static half_image_t * create_image(int fd, U32 size) {
+    half_image_t * image;
+    U32 i;
+
+    size = size & ~(U32)(smlst_blk_sz - 1);
+    if (size < smlst_blk_sz || size > lrgst_blk_sz || ftruncate(fd, (off_t)pool_offset() + size) != 0) {
+        mprint(HT_PERSIST_BAD_IMAGE, size);
+        return NULL;
+    }
+    image = (half_image_t *)mmap(NULL, pool_offset() + size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+
+    image->magic = half_persist_magic;
+    image->heap_header_size = sizeof(half_heap_t);
+    image->pool_size = size;
+    image->pool_offset = pool_offset();
+    image->state = HP_OPEN;
+    image->reserved = 0;
+    image->mapped_at = (unsigned long)image;
+    for (i = 0; i < half_root_cnt; i++) {
+        image->roots[i] = half_persist_null;
+    }
+    half_init_heap(&image->heap, (U8 *)image + image->pool_offset, size);
+    return image;
+}
+
+/**
+ * Maps an existing image, preferably where it was mapped last, and moves the pointers of its heap
+ * header if it lands somewhere else. Links inside the pool need no change. An image that was not
+ * closed is rebuilt, and every image is checked
+ */
+static half_image_t * map_image(int fd, off_t file_size) {
+    half_image_t header;
+    half_image_t * image;
+    half_heap_t * heap;
+    unsigned long old_pool;
+    U32 i;
+
+    if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+            || header.magic != half_persist_magic || header.heap_header_size != sizeof(half_heap_t)
+            || header.pool_offset != pool_offset() || file_size != (off_t)image_size(&header)) {
+        mprint(HT_PERSIST_BAD_IMAGE, header.pool_size);
+        return NULL;
+    }
+    image = (half_image_t *)mmap((void *)(unsigned long)header.mapped_at, image_size(&header),
+                                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (image == MAP_FAILED) {
+        return NULL;
+    }
+    heap = &image->heap;
+
+    old_pool = (unsigned long)image->mapped_at + image->pool_offset;
+    if ((unsigned long)heap->base != old_pool || heap->region_count != 1
+            || heap->size != image->pool_size || heap->total_size != image->pool_size) {
+        mprint(HT_PERSIST_BAD_IMAGE, image->pool_size);
+        munmap(image, image_size(image));
+        return NULL;
+    }
+    if ((unsigned long)image != image->mapped_at) {
+        mprint2(HT_PERSIST_REBASE, image, image->mapped_at);
+        heap->base = (U8 *)image + image->pool_offset;
+        heap->regions[0].base = heap->base;
+        heap->check_cursor = rebase(heap->check_cursor, old_pool, (unsigned long)heap->base);
+        for (i = 0; i < bucket_cnt; i++) {
+            heap->bucket_heads[i] = rebase(heap->bucket_heads[i], old_pool, (unsigned long)heap->base);
+        }
+#ifdef HALF_SLAB
+        for (i = 0; i < slab_cls_cnt; i++) {
+            heap->slab_partial[i] = rebase(heap->slab_partial[i], old_pool, (unsigned long)heap->base);
+        }
+#endif
+#ifdef HALF_QUICK
+        for (i = 0; i < quick_cnt; i++) {
+            heap->quick_heads[i] = rebase(heap->quick_heads[i], old_pool, (unsigned long)heap->base);
+        }
+#endif
+        image->mapped_at = (unsigned long)image;
+    }
+
+    if (image->state != HP_CLOSED && !half_rebuild_heap(heap)) {
+        munmap(image, image_size(image));
+        return NULL;
+    }
+    if (!heads_in_pool(heap)) {
+        mprint(HT_PERSIST_BAD_IMAGE, image->pool_size);
+        munmap(image, image_size(image));
+        return NULL;
+    }
+    // one whole sweep, a pool has at most one block per chunk
+    heap->check_cursor = heap->base;
+#ifdef HALF_HANDLE
+    heap->compact_cursor = heap->base;
+#endif
+    if (!half_check_heap(heap, (image->pool_size >> smlst_blk) + 1)) {
+        munmap(image, image_size(image));
+        return NULL;
+    }
+
+    image->state = HP_OPEN;
+    return image;
+}
+
+half_heap_t * half_open_persistent(const char * path, U32 size) {
+    half_image_t * image = NULL;
+    struct stat file;
+    int fd;
+
+    fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &file) == 0) {
+        image = file.st_size == 0 ? create_image(fd, size) : map_image(fd, file.st_size);
+    }
+    close(fd);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    // on disk before the heap changes, so a crash from here on is seen as one
+    msync(image, sizeof(half_image_t), MS_SYNC);
+    return &image->heap;
+}
+
+BOOL half_sync(half_heap_t * heap) {
+    half_image_t * image = image_of(heap);
+
+    return msync(image, image_size(image), MS_SYNC) == 0;
+}
+
+BOOL half_close_persistent(half_heap_t * heap) {
+    half_image_t * image = image_of(heap);
+    BOOL synced = half_sync(heap);
+
+    // only marked closed once the pool is on disk
+    if (synced) {
+        image->state = HP_CLOSED;
+        synced = msync(image, sizeof(half_image_t), MS_SYNC) == 0;
+    }
+    munmap(image, image_size(image));
+    return synced;
+}
+
+void half_set_root(half_heap_t * heap, U32 index, void * address) {
+    if (index < half_root_cnt) {
+        image_of(heap)->roots[index] = address ? (U32)((U8 *)address - heap->base) : half_persist_null;
+    }
+}
+
+void * half_get_root(half_heap_t * heap, U32 index) {
+    U32 offset;
+
+    if (index >= half_root_cnt) {
+        return NULL;
+    }
+    offset = image_of(heap)->roots[index];
+    return offset >= heap->size ? NULL : heap->base + offset;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef HALF_PERSIST_H_
+#define HALF_PERSIST_H_
+
+/*
+ * Heaps kept in a file, compiled in with HALF_PERSIST. Host only, the file is mapped with mmap.
+ *
+ * half_open_persistent maps a heap image and hands back the heap inside it, so a program that
+ * starts again finds its allocations where it left them instead of building them up again. The
+ * links inside the pool are chunk offsets from its base, so only the few pointers in the
+ * half_heap_t are moved when the image is mapped at another address. A program finds its data
+ * through the roots, addresses kept in the image as offsets.
+ *
+ * The image records whether it was closed. One that was not, because the program stopped in the
+ * middle of an update, has its buckets rebuilt from the block headers with half_rebuild_heap. A
+ * block that was being allocated or freed at that moment may end up allocated with no root
+ * pointing to it. Every image is checked with half_check_heap when it is opened and refused if
+ * the check fails. The pages are only known to be on disk after half_sync, so a power failure
+ * can leave an image that is refused.
+ *
+ * A persistent heap has the one region in the file, half_add_region_to must not be used on it.
+ * An image only opens in a program built with the flags it was made with.
+ */
+
+#include "half_fit.h"
+
+#define half_persist_magic    0x31504648 // "HFP1"
+#define half_persist_null     0xFFFFFFFF // the offset kept for a NULL root
+#define half_root_cnt         16
+
+typedef enum {
+    // closed with half_close_persistent
+    HP_CLOSED,
+    // mapped by a program, or left by one that stopped without closing it
+    HP_OPEN
+} half_persist_state_t;
+
+/**
+ * The start of an image file. The pool follows at the next page boundary
+ */
+typedef struct {
+    // half_persist_magic
+    U32 magic;
+    // sizeof(half_heap_t), differs between builds with different flags
+    U32 heap_header_size;
+    // pool size in bytes
+    U32 pool_size;
+    // offset of the pool in the file
+    U32 pool_offset;
+    // a half_persist_state_t
+    U32 state;
+    U32 reserved;
+    // where the image was mapped last, heap.base and the other pointers are relative to it
+    U64 mapped_at;
+    // offsets from the pool base, half_persist_null for NULL
+    U32 roots[half_root_cnt];
+    half_heap_t heap;
+} half_image_t;
+
+#ifdef HALF_PERSIST
+
+// Maps the image in 'path', or creates one with a pool of 'size' bytes if the file is missing or
+// empty. Returns NULL if the file is not an image, is one for another build, or fails its check
+half_heap_t * half_open_persistent( const char * path, U32 size );
+// Writes the changed pages of the image to disk. The heap should not be changed meanwhile
+BOOL          half_sync( half_heap_t * heap );
+// Syncs the image, marks it closed and unmaps it
+BOOL          half_close_persistent( half_heap_t * heap );
+void          half_set_root( half_heap_t * heap, U32 index, void * address );
+void *        half_get_root( half_heap_t * heap, U32 index );
+
+#endif
+
+#endif
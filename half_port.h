@@ -0,0 +1,219 @@
+#ifndef HALF_PORT_H_
+#define HALF_PORT_H_
+
+/*
+ * Target specific primitives used by the allocator. Bit scans use CLZ where the compiler has it.
+ * The locks and atomic bit operations of HALF_CONCURRENT use LDREX/STREX on the Cortex-M3, like
+ * Lock() in uart.c, and C11 atomics on a host.
+ */
+
+#include <lpc17xx.h>
+#include "type.h"
+
+#if defined(HALF_NO_CLZ) || !(defined(__CC_ARM) || defined(__GNUC__))
+extern const U8 half_log2_table[256];
+
+/**
+ * floor(log2(value)) for value > 0, with two table free shifts and one byte lookup
+ */
+static __inline U32 half_log2_floor(U32 value) {
+    U32 shift = (U32)((value >> 16) != 0) << 4;
+    shift += (U32)((value >> shift >> 8) != 0) << 3;
+    return shift + half_log2_table[value >> shift];
+}
+#else
+/**
+ * floor(log2(value)) for value > 0, a single CLZ instruction on the Cortex-M3
+ */
+static __inline U32 half_log2_floor(U32 value) {
+#ifdef __CC_ARM
+    return 31 - __clz(value);
+#else
+    return 31 - __builtin_clz(value);
+#endif
+}
+#endif
+
+/**
+ * Index of the lowest set bit of a non zero value. value & -value isolates that bit
+ */
+static __inline U32 half_lowest_bit(U32 value) {
+    return half_log2_floor(value & (0u - value));
+}
+
+#ifdef LPC17XX_HOST
+#if defined(__i386__) || defined(__x86_64__)
+/**
+ * Free running cycle counter, the time stamp counter on a PC
+ */
+static __inline U32 half_cycles(void) {
+    return (U32)__builtin_ia32_rdtsc();
+}
+#else
+#include <time.h>
+
+/**
+ * Free running counter for timestamps, in nanoseconds on a host without a time stamp counter
+ */
+static __inline U32 half_cycles(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (U32)now.tv_sec * 1000000000u + (U32)now.tv_nsec;
+}
+#endif
+
+static __inline void half_cycles_init(void) {
+}
+#else
+// Cortex-M3 debug registers. The LPC17xx CMSIS headers do not define the DWT block
+#define HALF_DEMCR       (*(volatile U32 *)0xE000EDFC)
+#define HALF_DWT_CTRL    (*(volatile U32 *)0xE0001000)
+#define HALF_DWT_CYCCNT  (*(volatile U32 *)0xE0001004)
+
+/**
+ * Starts the DWT cycle counter, which counts core clock cycles and wraps every 43 s at 100 MHz
+ */
+static __inline void half_cycles_init(void) {
+    HALF_DEMCR |= 1u << 24; // TRCENA
+    HALF_DWT_CYCCNT = 0;
+    HALF_DWT_CTRL |= 1u;    // CYCCNTENA
+}
+
+static __inline U32 half_cycles(void) {
+    return HALF_DWT_CYCCNT;
+}
+#endif
+
+#ifdef HALF_CONCURRENT
+
+#ifdef LPC17XX_HOST
+
+#include <stdatomic.h>
+#include <sched.h>
+
+#define half_spin_limit  64 // looks at a held lock this often before giving up the CPU
+
+typedef atomic_uint half_lock_t;
+typedef atomic_uint half_atomic_t;
+
+// lets another thread finish what this one is waiting for
+static __inline void half_yield(void) {
+    sched_yield();
+}
+
+static __inline void half_lock_acquire(half_lock_t *lock) {
+    U32 spins = 0;
+
+    while (atomic_exchange_explicit(lock, 1, memory_order_acquire) != 0) {
+        // wait for the holder without bouncing the cache line, and let it run if it was preempted
+        while (atomic_load_explicit(lock, memory_order_relaxed) != 0) {
+            if (++spins == half_spin_limit) {
+                spins = 0;
+                half_yield();
+            }
+        }
+    }
+}
+
+static __inline void half_lock_release(half_lock_t *lock) {
+    atomic_store_explicit(lock, 0, memory_order_release);
+}
+
+static __inline void half_atomic_or(half_atomic_t *value, U32 bits) {
+    atomic_fetch_or_explicit(value, bits, memory_order_relaxed);
+}
+
+static __inline void half_atomic_and(half_atomic_t *value, U32 bits) {
+    atomic_fetch_and_explicit(value, bits, memory_order_relaxed);
+}
+
+static __inline void half_atomic_add(half_atomic_t *value, U32 delta) {
+    atomic_fetch_add_explicit(value, delta, memory_order_acq_rel);
+}
+
+static __inline U32 half_atomic_load(half_atomic_t *value) {
+    return atomic_load_explicit(value, memory_order_acquire);
+}
+
+static __inline void half_atomic_store(half_atomic_t *value, U32 new_value) {
+    atomic_store_explicit(value, new_value, memory_order_release);
+}
+
+// raises the value to 'candidate' if it is lower
+static __inline void half_atomic_max(half_atomic_t *value, U32 candidate) {
+    unsigned int current = atomic_load_explicit(value, memory_order_relaxed);
+
+    while (candidate > current
+           && !atomic_compare_exchange_weak_explicit(value, &current, candidate, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+#else
+
+typedef volatile U32 half_lock_t;
+typedef volatile U32 half_atomic_t;
+
+static __inline void half_lock_acquire(half_lock_t *lock) {
+    for (;;) {
+        // Get the lock status and see if it is already locked
+        if (__LDREXW(lock) == 0) {
+            // if not locked, try set lock to 1
+            if (__STREXW(1, lock) == 0) {
+                break;
+            }
+        } else {
+            __CLREX();
+        }
+    }
+    __DMB();
+}
+
+static __inline void half_lock_release(half_lock_t *lock) {
+    __DMB();
+    *lock = 0;
+}
+
+// lets another thread finish what this one is waiting for
+static __inline void half_yield(void) {
+    __NOP();
+}
+
+static __inline void half_atomic_or(half_atomic_t *value, U32 bits) {
+    while (__STREXW(__LDREXW(value) | bits, value) != 0) {
+    }
+}
+
+static __inline void half_atomic_and(half_atomic_t *value, U32 bits) {
+    while (__STREXW(__LDREXW(value) & bits, value) != 0) {
+    }
+}
+
+static __inline void half_atomic_add(half_atomic_t *value, U32 delta) {
+    while (__STREXW(__LDREXW(value) + delta, value) != 0) {
+    }
+}
+
+static __inline U32 half_atomic_load(half_atomic_t *value) {
+    return *value;
+}
+
+static __inline void half_atomic_store(half_atomic_t *value, U32 new_value) {
+    __DMB();
+    *value = new_value;
+}
+
+// raises the value to 'candidate' if it is lower
+static __inline void half_atomic_max(half_atomic_t *value, U32 candidate) {
+    do {
+        if (__LDREXW(value) >= candidate) {
+            __CLREX();
+            return;
+        }
+    } while (__STREXW(candidate, value) != 0);
+}
+
+#endif
+
+#endif /* HALF_CONCURRENT */
+
+#endif
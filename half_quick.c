@@ -0,0 +1,156 @@
+
+#include "half_quick.h"
+#include "half_port.h"
+
+#ifdef HALF_QUICK
+
+#ifdef HALF_CONCURRENT
+#define lock_quick(heap)    half_lock_acquire(&(heap)->quick_lock)
+#define unlock_quick(heap)  half_lock_release(&(heap)->quick_lock)
+#else
+#define lock_quick(heap)
+#define unlock_quick(heap)
+#endif
+
+/**
+ * The list link sits where a free block keeps its bucket links. A block points to itself to
+ * indicate null
+ */
+static __inline unused_block_header_t * quick_link(void * block) {
+    return (unused_block_header_t *)((U8 *)block + sizeof(block_header_t));
+}
+
+static __inline void * quick_next(half_heap_t * heap, void * block) {
+    return expand_link(heap, quick_link(block)->next_region, quick_link(block)->next_block, block);
+}
+
+static __inline void set_quick_next(half_heap_t * heap, void * block, void * next) {
+    quick_link(block)->next_block = shorten_address(heap, next);
+    quick_link(block)->next_region = get_region_index(heap, next);
+}
+
+/**
+ * Cuts a list after its 'keep' most recently freed blocks. Must be called holding the quick lock
+ * @return The first block cut off, NULL if the list was not longer
+ */
+static void * cut_list(half_heap_t * heap, U32 list_index, U32 keep) {
+    void * block = heap->quick_heads[list_index];
+    void * next;
+    U32 i;
+
+    if (keep == 0) {
+        heap->quick_heads[list_index] = NULL;
+        heap->quick_lengths[list_index] = 0;
+        return block;
+    }
+    for (i = 1; i < keep && block; i++) {
+        block = quick_next(heap, block);
+    }
+    if (block == NULL) {
+        return NULL;
+    }
+    next = quick_next(heap, block);
+    set_quick_next(heap, block, block);
+    heap->quick_lengths[list_index] = keep;
+    return next;
+}
+
+/**
+ * Gives a cut off list back to the heap, merging each block with its free neighbours
+ */
+static void release_list(half_heap_t * heap, void * block) {
+    void * next;
+
+    while (block) {
+        next = quick_next(heap, block);
+        free_block(heap, (U8 *)block + sizeof(block_header_t));
+        block = next;
+    }
+}
+
+void half_quick_init(half_heap_t * heap) {
+    U32 i;
+
+    for (i = 0; i < quick_cnt; i++) {
+        heap->quick_heads[i] = NULL;
+        heap->quick_lengths[i] = 0;
+    }
+#ifdef HALF_CONCURRENT
+    heap->quick_lock = 0;
+#endif
+}
+
+void *half_quick_alloc(half_heap_t * heap, U32 size) {
+    U32 list_index;
+    void * block;
+
+    if (size > (quick_cnt << smlst_blk) - sizeof(block_header_t)) {
+        return NULL;
+    }
+    // lists are indexed by the block size in chunks minus one, as block_size stores it
+    list_index = (round_up_to_chunk_size(size + sizeof(block_header_t)) >> smlst_blk) - 1;
+
+    lock_quick(heap);
+    block = heap->quick_heads[list_index];
+    if (block) {
+        heap->quick_heads[list_index] = quick_next(heap, block);
+        heap->quick_lengths[list_index]--;
+    }
+    unlock_quick(heap);
+
+    return block ? (U8 *)block + sizeof(block_header_t) : NULL;
+}
+
+/**
+ * Keeps a freed block on the list of its size. A list that grows past quick_max_len keeps its
+ * most recent half and the rest is merged
+ * @param heap
+ * @param address Payload right after the block header
+ */
+BOOL half_quick_free(half_heap_t * heap, void * address) {
+    void * block = (U8 *)address - sizeof(block_header_t);
+    void * next;
+    void * released = NULL;
+    U32 list_index;
+
+    lock_quick(heap);
+    // read without the merge lock: the size of an allocated block only changes by its owner,
+    // other threads only rewrite the link bits of its header
+    list_index = ((block_header_t *)block)->block_size;
+    if (list_index >= quick_cnt) {
+        unlock_quick(heap);
+        return __FALSE;
+    }
+    next = heap->quick_heads[list_index];
+    set_quick_next(heap, block, next ? next : block);
+    heap->quick_heads[list_index] = block;
+    if (++heap->quick_lengths[list_index] > quick_max_len) {
+        released = cut_list(heap, list_index, quick_max_len >> 1);
+    }
+    unlock_quick(heap);
+
+    release_list(heap, released);
+    return __TRUE;
+}
+
+BOOL half_quick_flush(half_heap_t * heap) {
+    void * lists[quick_cnt];
+    BOOL released = __FALSE;
+    U32 i;
+
+    lock_quick(heap);
+    for (i = 0; i < quick_cnt; i++) {
+        lists[i] = cut_list(heap, i, 0);
+    }
+    unlock_quick(heap);
+
+    for (i = 0; i < quick_cnt; i++) {
+        if (lists[i]) {
+            release_list(heap, lists[i]);
+            released = __TRUE;
+        }
+    }
+    return released;
+}
+
+#endif /* HALF_QUICK */
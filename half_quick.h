@@ -0,0 +1,28 @@
+#ifndef HALF_QUICK_H_
+#define HALF_QUICK_H_
+
+/*
+ * Quick lists of freed blocks, compiled in with HALF_QUICK.
+ *
+ * Blocks of 1 to quick_cnt chunks are not merged when they are freed. They go on a LIFO list of
+ * their exact size and the next request that rounds up to that size takes them back, so a
+ * free/alloc pair of the same size neither merges nor splits. The blocks stay marked as allocated,
+ * so neighbours do not merge with them either. A list longer than quick_max_len gives its oldest
+ * blocks back to the heap, and all lists are given back before an allocation fails.
+ */
+
+#include "half_fit.h"
+
+#ifndef quick_max_len
+#define quick_max_len  16 // blocks a list may hold before the oldest half is merged
+#endif
+
+void  half_quick_init( half_heap_t * heap );
+// Takes a block of exactly the size 'size' rounds up to, NULL if its list is empty
+void *half_quick_alloc( half_heap_t * heap, U32 size );
+// Returns __FALSE if the block is not kept and must be freed as usual
+BOOL  half_quick_free( half_heap_t * heap, void * address );
+// Merges every listed block back into the heap. __TRUE if there were any
+BOOL  half_quick_flush( half_heap_t * heap );
+
+#endif
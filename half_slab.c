@@ -0,0 +1,284 @@
+
+#include "half_slab.h"
+#include "half_port.h"
+#include <stdio.h>
+
+#ifdef HALF_SLAB
+
+#define SLAB_BLOCK_SIZE   256 // bytes per slab, including the block header
+#define SLAB_SLOTS_OFFSET 16  // the first slot starts this far into the block
+#define SLAB_CHUNKS       ( SLAB_BLOCK_SIZE >> smlst_blk ) // 8
+
+#ifdef HALF_CONCURRENT
+#define lock_slabs(heap)    half_lock_acquire(&(heap)->slab_lock)
+#define unlock_slabs(heap)  half_lock_release(&(heap)->slab_lock)
+#else
+#define lock_slabs(heap)
+#define unlock_slabs(heap)
+#endif
+
+/**
+ * Sits in the payload of a slab block, right after the block header
+ */
+typedef struct {
+    // bit i is set if slot i is free
+    U32 free_map;
+    // the other slabs of this slot size with free slots. A slab points to itself to indicate null
+    unsigned int previous_slab : 10;
+    unsigned int next_slab : 10;
+    unsigned int previous_region : region_bits;
+    unsigned int next_region : region_bits;
+    // slots are (size_class + 1) * 8 bytes
+    unsigned int size_class : 2;
+    // 1 while the slab is on its partial list
+    unsigned int listed : 1;
+    // pads the first slot to an 8 byte boundary
+    U32 reserved;
+} slab_header_t;
+
+static __inline slab_header_t * slab_header(void * block) {
+    return (slab_header_t *)((U8 *)block + sizeof(block_header_t));
+}
+
+static __inline U32 slot_size(U32 size_class) {
+    return (size_class + 1) << 3;
+}
+
+/**
+ * Bitmap with a bit set for every slot of an empty slab
+ */
+static __inline U32 all_slots(U32 size_class) {
+    return (1u << ((SLAB_BLOCK_SIZE - SLAB_SLOTS_OFFSET) / slot_size(size_class))) - 1;
+}
+
+/**
+ * Bit of the chunk an address is in, in the slab_starts words of its region
+ */
+static __inline U32 chunk_of(half_heap_t * heap, U32 region_index, void * address) {
+    return (U32)((U8 *)address - heap->regions[region_index].base) >> smlst_blk;
+}
+
+static __inline void set_previous_slab(half_heap_t * heap, void * block, void * previous) {
+    slab_header(block)->previous_slab = shorten_address(heap, previous);
+    slab_header(block)->previous_region = get_region_index(heap, previous);
+}
+
+static __inline void set_next_slab(half_heap_t * heap, void * block, void * next) {
+    slab_header(block)->next_slab = shorten_address(heap, next);
+    slab_header(block)->next_region = get_region_index(heap, next);
+}
+
+/**
+ * Puts the slab at the front of the partial list of its slot size
+ */
+static void link_slab(half_heap_t * heap, void * block) {
+    slab_header_t * slab = slab_header(block);
+    void * next = heap->slab_partial[slab->size_class];
+
+    set_previous_slab(heap, block, block);
+    if (next) {
+        set_previous_slab(heap, next, block);
+        set_next_slab(heap, block, next);
+    } else {
+        set_next_slab(heap, block, block);
+    }
+    heap->slab_partial[slab->size_class] = block;
+    slab->listed = 1;
+}
+
+static void unlink_slab(half_heap_t * heap, void * block) {
+    slab_header_t * slab = slab_header(block);
+    void * previous = expand_link(heap, slab->previous_region, slab->previous_slab, block);
+    void * next = expand_link(heap, slab->next_region, slab->next_slab, block);
+
+    if (previous) {
+        set_next_slab(heap, previous, next ? next : previous);
+    } else {
+        heap->slab_partial[slab->size_class] = next;
+    }
+    if (next) {
+        set_previous_slab(heap, next, previous ? previous : next);
+    }
+    slab->listed = 0;
+}
+
+/**
+ * Finds the slab holding the given address. Slabs never overlap and span 8 chunks, so only the
+ * 8 chunks up to the address's own chunk can start it
+ * @return the slab block, NULL if the address is not in a slab
+ */
+static void * find_slab(half_heap_t * heap, void * address) {
+    U32 region_index = get_region_index(heap, address);
+    U32 address_chunk = chunk_of(heap, region_index, address);
+    U32 * starts = heap->slab_starts[region_index];
+    U32 chunk;
+    U32 i;
+    void * block;
+
+    // an address outside every region lands on a large chunk of region 0
+    if (address_chunk >= (lrgst_blk_sz >> smlst_blk)) {
+        return NULL;
+    }
+    for (i = 0; i < SLAB_CHUNKS && i <= address_chunk; i++) {
+        chunk = address_chunk - i;
+        if (starts[chunk >> 5] & (1u << (chunk & 31))) {
+            block = heap->regions[region_index].base + (chunk << smlst_blk);
+            if ((U8 *)address < (U8 *)block + SLAB_BLOCK_SIZE) {
+                return block;
+            }
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Gives an empty slab's block back to the heap
+ */
+static void release_slab(half_heap_t * heap, void * block) {
+    U32 region_index = get_region_index(heap, block);
+    U32 chunk = chunk_of(heap, region_index, block);
+
+    mprint(HT_SLAB_RELEASE, block);
+    if (slab_header(block)->listed) {
+        unlink_slab(heap, block);
+    }
+    heap->slab_starts[region_index][chunk >> 5] &= ~(1u << (chunk & 31));
+    free_block(heap, (U8 *)block + sizeof(block_header_t));
+}
+
+void half_slab_init(half_heap_t * heap) {
+    U32 i, j;
+
+    for (i = 0; i < slab_cls_cnt; i++) {
+        heap->slab_partial[i] = NULL;
+    }
+    for (i = 0; i < region_cnt; i++) {
+        for (j = 0; j < 32; j++) {
+            heap->slab_starts[i][j] = 0;
+        }
+    }
+#ifdef HALF_CONCURRENT
+    heap->slab_lock = 0;
+#endif
+}
+
+/**
+ * Allocates a slot of the smallest size that holds 'size' bytes
+ * @param heap
+ * @param size At most slab_max_sz
+ * @return Pointer, 8 byte aligned from the heap base. NULL if there is no slot and no block for a new slab
+ */
+void *half_slab_alloc(half_heap_t * heap, U32 size) {
+    U32 size_class = size ? (size - 1) >> 3 : 0;
+    void * block;
+    slab_header_t * slab;
+    U32 slot;
+    U32 region_index;
+    U32 chunk;
+
+    lock_slabs(heap);
+    block = heap->slab_partial[size_class];
+    if (block == NULL) {
+        void * payload = allocate_block(heap, SLAB_BLOCK_SIZE - sizeof(block_header_t));
+        if (payload == NULL) {
+            unlock_slabs(heap);
+            return NULL;
+        }
+        mprint2(HT_SLAB_NEW, payload, slot_size(size_class));
+        block = (U8 *)payload - sizeof(block_header_t);
+        slab = slab_header(block);
+        slab->free_map = all_slots(size_class);
+        slab->size_class = size_class;
+        slab->reserved = 0;
+        link_slab(heap, block);
+
+        region_index = get_region_index(heap, block);
+        chunk = chunk_of(heap, region_index, block);
+        heap->slab_starts[region_index][chunk >> 5] |= 1u << (chunk & 31);
+    }
+
+    slab = slab_header(block);
+    slot = half_lowest_bit(slab->free_map);
+    slab->free_map &= ~(1u << slot);
+    if (slab->free_map == 0) {
+        // full, the next allocation looks at another slab
+        unlink_slab(heap, block);
+    }
+    unlock_slabs(heap);
+
+    return (U8 *)block + SLAB_SLOTS_OFFSET + slot * slot_size(size_class);
+}
+
+/**
+ * Returns a slot to its slab. An empty slab goes back to the heap, unless it is the only slab of
+ * its slot size with free slots, to avoid taking and returning a block on every alloc/free pair
+ */
+BOOL half_slab_free(half_heap_t * heap, void * address) {
+    void * block;
+    slab_header_t * slab;
+    U32 offset;
+    U32 slot;
+    U32 size;
+
+    lock_slabs(heap);
+    block = find_slab(heap, address);
+    if (block == NULL) {
+        unlock_slabs(heap);
+        return __FALSE;
+    }
+
+    slab = slab_header(block);
+    size = slot_size(slab->size_class);
+    // addresses in the slab header wrap around to a large offset
+    offset = (U32)((U8 *)address - (U8 *)block) - SLAB_SLOTS_OFFSET;
+    slot = offset / size;
+    if (offset >= SLAB_BLOCK_SIZE - SLAB_SLOTS_OFFSET || offset % size != 0 || (slab->free_map & (1u << slot)) != 0) {
+        mprint(HT_SLAB_BAD_SLOT, address);
+        unlock_slabs(heap);
+        return __TRUE;
+    }
+
+    slab->free_map |= 1u << slot;
+    if (!slab->listed) {
+        link_slab(heap, block);
+    } else if (slab->free_map == all_slots(slab->size_class)
+            && (heap->slab_partial[slab->size_class] != block || expand_link(heap, slab->next_region, slab->next_slab, block) != NULL)) {
+        release_slab(heap, block);
+    }
+    unlock_slabs(heap);
+    return __TRUE;
+}
+
+U32 half_slab_slot_size(half_heap_t * heap, void * address) {
+    void * block;
+    U32 size = 0;
+
+    lock_slabs(heap);
+    block = find_slab(heap, address);
+    if (block) {
+        size = slot_size(slab_header(block)->size_class);
+    }
+    unlock_slabs(heap);
+    return size;
+}
+
+BOOL half_slab_trim(half_heap_t * heap) {
+    BOOL released = __FALSE;
+    void * block;
+    U32 i;
+
+    lock_slabs(heap);
+    // half_slab_free leaves at most the one empty slab at the head of each list
+    for (i = 0; i < slab_cls_cnt; i++) {
+        block = heap->slab_partial[i];
+        if (block && slab_header(block)->free_map == all_slots(i)) {
+            release_slab(heap, block);
+            released = __TRUE;
+        }
+    }
+    unlock_slabs(heap);
+    return released;
+}
+
+#endif /* HALF_SLAB */
@@ -0,0 +1,23 @@
+#ifndef HALF_SLAB_H_
+#define HALF_SLAB_H_
+
+/*
+ * Slab layer for objects smaller than a chunk, compiled in with HALF_SLAB.
+ *
+ * A slab is one 256 byte block taken from the heap and cut into equal slots of 8, 16 or 24
+ * bytes, with a bitmap of the free slots. Slot pointers are 8 byte aligned from the heap base,
+ * block payloads are always 4 bytes past a chunk boundary, so half_free can tell them apart.
+ */
+
+#include "half_fit.h"
+
+void  half_slab_init( half_heap_t * heap );
+void *half_slab_alloc( half_heap_t * heap, U32 size );
+// Returns __FALSE if the address is not inside a slab of this heap
+BOOL  half_slab_free( half_heap_t * heap, void * address );
+// Bytes usable at a slot address, 0 if the address is not inside a slab of this heap
+U32   half_slab_slot_size( half_heap_t * heap, void * address );
+// Returns the empty slabs kept for reuse to the heap. __TRUE if there were any
+BOOL  half_slab_trim( half_heap_t * heap );
+
+#endif
@@ -0,0 +1,259 @@
+#include "half_fit.h"
+#include "half_tcache.h"
+#include "half_port.h"
+
+#ifdef HALF_TCACHE
+
+#include <stdatomic.h>
+
+/**
+ * A cached block. The link lives in the payload, which is at least 28 bytes
+ */
+typedef struct tcache_entry {
+    struct tcache_entry * next;
+} tcache_entry_t;
+
+typedef struct {
+    tcache_entry_t * heads[tcache_bkt_cnt];
+    U32 counts[tcache_bkt_cnt];
+    // the cache is only valid while this matches tcache_epoch
+    U32 epoch;
+} tcache_t;
+
+static _Thread_local tcache_t tcache;
+
+// bumped by half_tcache_invalidate. Starts at 1 so a fresh, zeroed cache is stale
+static atomic_uint tcache_epoch = 1;
+
+#ifdef HALF_CONCURRENT
+// the heap does its own fine grained locking
+#define lock_heap()
+#define unlock_heap()
+#else
+// guards the default heap on cache misses and flushes
+static atomic_flag heap_lock = ATOMIC_FLAG_INIT;
+
+static void lock_heap(void) {
+    while (atomic_flag_test_and_set_explicit(&heap_lock, memory_order_acquire)) {
+        // spin
+    }
+}
+
+static void unlock_heap(void) {
+    atomic_flag_clear_explicit(&heap_lock, memory_order_release);
+}
+#endif
+
+/**
+ * Size in bytes of the block holding the given payload, including the header. Read without
+ * any lock: the size of an allocated block never changes, other threads only rewrite the
+ * previous_block bits of its header
+ */
+static U32 cached_block_size(void * address) {
+    return expand_block_size(((block_header_t *)((U8 *)address - sizeof(block_header_t)))->block_size);
+}
+
+/**
+ * The cache's own size class, the power of two of the block size in chunks. Coarser than the heap's
+ * buckets, so a few lists cover the small sizes
+ */
+static __inline U32 cache_index(U32 block_size) {
+    return half_log2_floor(block_size >> smlst_blk);
+}
+
+/**
+ * Forgets the cached blocks if the heap was reset since they were cached
+ */
+static void check_epoch(void) {
+    U32 epoch = atomic_load_explicit(&tcache_epoch, memory_order_acquire);
+    U32 i;
+
+    if (tcache.epoch != epoch) {
+        for (i = 0; i < tcache_bkt_cnt; i++) {
+            tcache.heads[i] = NULL;
+            tcache.counts[i] = 0;
+        }
+        tcache.epoch = epoch;
+    }
+}
+
+static void *pop(U32 bucket_index) {
+    tcache_entry_t * entry = tcache.heads[bucket_index];
+    tcache.heads[bucket_index] = entry->next;
+    tcache.counts[bucket_index]--;
+    return entry;
+}
+
+/**
+ * Keeps the 'keep' most recently freed blocks of a bucket and returns the rest to the heap
+ * while holding the heap lock once
+ */
+static void flush_bucket(U32 bucket_index, U32 keep) {
+    tcache_entry_t * entry;
+    tcache_entry_t * next;
+    tcache_entry_t ** link = &tcache.heads[bucket_index];
+    U32 i;
+
+    for (i = 0; i < keep && *link; i++) {
+        link = &(*link)->next;
+    }
+    entry = *link;
+    *link = NULL;
+    tcache.counts[bucket_index] = i;
+
+    if (entry == NULL) {
+        return;
+    }
+    lock_heap();
+    while (entry) {
+        next = entry->next;
+        half_free_to(&half_default_heap, entry);
+        entry = next;
+    }
+    unlock_heap();
+}
+
+void *half_tcache_alloc(U32 size) {
+    U32 effective_size;
+    U32 bucket_index;
+    void * address;
+
+    check_epoch();
+
+#ifdef HALF_SLAB
+    // sizes the slab layer serves are left to it
+    if (size > slab_max_sz && size <= lrgst_blk_sz) {
+#else
+    if (size <= lrgst_blk_sz) {
+#endif
+        effective_size = round_up_to_chunk_size(size + sizeof(block_header_t));
+        bucket_index = cache_index(effective_size);
+
+        if (bucket_index < tcache_bkt_cnt) {
+            // the most recently freed block of this bucket fits a same sized request
+            if (tcache.heads[bucket_index] && cached_block_size(tcache.heads[bucket_index]) >= effective_size) {
+                return pop(bucket_index);
+            }
+            // every block of the next bucket up fits
+            if (bucket_index + 1 < tcache_bkt_cnt && tcache.heads[bucket_index + 1]) {
+                return pop(bucket_index + 1);
+            }
+        }
+    }
+
+    lock_heap();
+    address = half_alloc_from(&half_default_heap, size);
+    unlock_heap();
+
+    if (address == NULL) {
+        // blocks sitting in this thread's cache may be what the heap is missing
+        half_tcache_flush();
+        lock_heap();
+        address = half_alloc_from(&half_default_heap, size);
+        unlock_heap();
+    }
+    return address;
+}
+
+void half_tcache_free(void * address) {
+    U32 bucket_index;
+    tcache_entry_t * entry = (tcache_entry_t *)address;
+
+    if (address == NULL) {
+        return;
+    }
+    check_epoch();
+
+    // slab slots and aligned payloads have no block header right before them
+    if ((((U8 *)address - half_default_heap.base) & (smlst_blk_sz - 1)) != sizeof(block_header_t)) {
+        lock_heap();
+        half_free_to(&half_default_heap, address);
+        unlock_heap();
+        return;
+    }
+    bucket_index = cache_index(cached_block_size(address));
+    if (bucket_index < tcache_bkt_cnt) {
+        entry->next = tcache.heads[bucket_index];
+        tcache.heads[bucket_index] = entry;
+        if (++tcache.counts[bucket_index] > tcache_high) {
+            flush_bucket(bucket_index, tcache_low);
+        }
+        return;
+    }
+
+    lock_heap();
+    half_free_to(&half_default_heap, address);
+    unlock_heap();
+}
+
+void *half_tcache_realloc(void * address, U32 size) {
+    void * new_address;
+
+    if (address == NULL) {
+        return half_tcache_alloc(size);
+    }
+    if (size == 0) {
+        half_tcache_free(address);
+        return NULL;
+    }
+    lock_heap();
+    new_address = half_realloc_in(&half_default_heap, address, size);
+    unlock_heap();
+    return new_address;
+}
+
+void *half_tcache_memalign(U32 alignment, U32 size) {
+    void * address;
+
+    lock_heap();
+    address = half_memalign_from(&half_default_heap, alignment, size);
+    unlock_heap();
+    return address;
+}
+
+U32 half_tcache_alloc_batch(U32 size, U32 count, void ** addresses) {
+    U32 allocated;
+
+    lock_heap();
+    allocated = half_alloc_batch_from(&half_default_heap, size, count, addresses);
+    unlock_heap();
+    return allocated;
+}
+
+void half_tcache_free_batch(void ** addresses, U32 count) {
+    lock_heap();
+    half_free_batch_to(&half_default_heap, addresses, count);
+    unlock_heap();
+}
+
+BOOL half_tcache_check(U32 budget) {
+    BOOL ok;
+
+    lock_heap();
+    ok = half_check_heap(&half_default_heap, budget);
+    unlock_heap();
+    return ok;
+}
+
+void half_tcache_get_stats(struct half_stats * stats) {
+    // the heap never sees what the cache hands out, so the calling thread's share goes back first
+    half_tcache_flush();
+    lock_heap();
+    half_get_stats_of(&half_default_heap, stats);
+    unlock_heap();
+}
+
+void half_tcache_flush(void) {
+    U32 i;
+
+    check_epoch();
+    for (i = 0; i < tcache_bkt_cnt; i++) {
+        flush_bucket(i, 0);
+    }
+}
+
+void half_tcache_invalidate(void) {
+    atomic_fetch_add_explicit(&tcache_epoch, 1, memory_order_acq_rel);
+}
+
+#endif /* HALF_TCACHE */
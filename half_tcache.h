@@ -0,0 +1,40 @@
+#ifndef HALF_TCACHE_H_
+#define HALF_TCACHE_H_
+
+/*
+ * Per thread cache of freed blocks in front of half_alloc / half_free, for multi threaded host
+ * builds. Compiled in with HALF_TCACHE, needs C11 threads and atomics.
+ *
+ * Each thread keeps a LIFO list of its own freed blocks for every small power of two size. A
+ * cache hit touches no shared state. Misses and flushes go to the default heap under a single
+ * lock, or straight to it when the heap does its own locking (HALF_CONCURRENT).
+ * Cached blocks stay marked as allocated in the heap, so they are never coalesced.
+ */
+
+#include "type.h"
+
+struct half_stats;
+
+#define tcache_bkt_cnt   4   // blocks of 1, 2-3, 4-7 and 8-15 chunks are cached, up to 511 bytes
+#define tcache_high      8   // a bucket holding more than this many blocks is flushed
+#define tcache_low       4   // blocks a bucket keeps after it is flushed
+
+void *half_tcache_alloc( U32 size );
+void  half_tcache_free( void * address );
+// Resizes, aligned allocations, batches and checks go to the default heap, the block never passes through the cache
+void *half_tcache_realloc( void * address, U32 size );
+void *half_tcache_memalign( U32 alignment, U32 size );
+U32   half_tcache_alloc_batch( U32 size, U32 count, void ** addresses );
+void  half_tcache_free_batch( void ** addresses, U32 count );
+BOOL  half_tcache_check( U32 budget );
+// Flushes the calling thread's cache, then takes the default heap's stats. Cache hits and the
+// frees that fill the cache are not counted, a block only counts as freed once it is flushed
+void  half_tcache_get_stats( struct half_stats * stats );
+
+// Returns every block cached by the calling thread to the heap. Call before a thread exits
+void  half_tcache_flush( void );
+
+// Drops the contents of every thread's cache without freeing them, used when the heap is reset
+void  half_tcache_invalidate( void );
+
+#endif
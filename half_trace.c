@@ -0,0 +1,85 @@
+
+#include "half_trace.h"
+#include "half_port.h"
+
+#if HALF_TRACE == HALF_TRACE_PRINTF
+
+const char * const half_trace_formats[HT_COUNT] = {
+#define HALF_TRACE_FORMAT(name, format)  format,
+    HALF_TRACE_EVENTS(HALF_TRACE_FORMAT)
+#undef HALF_TRACE_FORMAT
+};
+
+#elif HALF_TRACE == HALF_TRACE_RING
+
+#ifdef LPC17XX_HOST
+#include <stdatomic.h>
+static atomic_uint trace_next;
+#else
+static volatile U32 trace_next;
+#endif
+
+static half_trace_record_t trace_ring[half_trace_ring_sz];
+
+/**
+ * Reserves the next record. Lock free, so events from several threads or from interrupts
+ * never wait on each other
+ * @return Number of events recorded before this one
+ */
+static __inline U32 claim_record(void) {
+#ifdef LPC17XX_HOST
+    return atomic_fetch_add_explicit(&trace_next, 1, memory_order_relaxed);
+#else
+    U32 next;
+    do {
+        next = __LDREXW(&trace_next);
+    } while (__STREXW(next + 1, &trace_next) != 0);
+    return next;
+#endif
+}
+
+void half_trace_init(void) {
+    half_cycles_init();
+#ifdef LPC17XX_HOST
+    atomic_store_explicit(&trace_next, 0, memory_order_relaxed);
+#else
+    trace_next = 0;
+#endif
+}
+
+void half_trace_record(U32 event, U32 arg_count, U32 arg1, U32 arg2, U32 arg3) {
+    // the oldest record is overwritten once the ring is full. A writer that laps a slow one can
+    // leave a torn record, which only costs that one event
+    half_trace_record_t * record = &trace_ring[claim_record() & (half_trace_ring_sz - 1)];
+
+    record->timestamp = half_cycles();
+    record->event = (U16)event;
+    record->arg_count = (U16)arg_count;
+    record->args[0] = arg1;
+    record->args[1] = arg2;
+    record->args[2] = arg3;
+}
+
+void half_trace_dump(FILE * out) {
+    half_trace_dump_header_t header;
+    U32 first;
+    U32 i;
+
+#ifdef LPC17XX_HOST
+    header.total = atomic_load_explicit(&trace_next, memory_order_acquire);
+#else
+    header.total = trace_next;
+#endif
+    header.magic = half_trace_magic;
+    header.record_count = header.total < half_trace_ring_sz ? header.total : half_trace_ring_sz;
+    header.record_size = sizeof(half_trace_record_t);
+    fwrite(&header, sizeof(header), 1, out);
+
+    first = header.total - header.record_count;
+    for (i = 0; i < header.record_count; i++) {
+        fwrite(&trace_ring[(first + i) & (half_trace_ring_sz - 1)], sizeof(half_trace_record_t), 1, out);
+    }
+    fflush(out);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef HALF_TRACE_H_
+#define HALF_TRACE_H_
+
+/*
+ * Tracing of the allocator's internal steps, chosen at compile time with HALF_TRACE:
+ *   HALF_TRACE_OFF     the mprint macros compile to nothing, not even their arguments
+ *   HALF_TRACE_PRINTF  every event is formatted with printf right away (the default)
+ *   HALF_TRACE_RING    every event is stored as a binary record with a cycle timestamp in a ring
+ *                      buffer. half_trace_dump writes the ring out, host/half_trace_decode.c
+ *                      formats it on a PC
+ *
+ * Events are listed once below with their format string, so the printf backend and the decoder
+ * print the same text.
+ */
+
+#include "type.h"
+#include <stdio.h>
+
+#define HALF_TRACE_OFF     0
+#define HALF_TRACE_PRINTF  1
+#define HALF_TRACE_RING    2
+
+#ifndef HALF_TRACE
+#define HALF_TRACE  HALF_TRACE_PRINTF
+#endif
+
+#define half_trace_ring_sz    128 // records, a power of two
+#define half_trace_magic      0x31525448 // "HTR1"
+
+// X(name, format). Each event takes as many arguments as its format has conversions, at most 3
+#define HALF_TRACE_EVENTS(X) \
+    X(INIT_START,                 "Starting init\n") \
+    X(INIT_BAD_POOL,              "ERROR: can not create a heap at %d with size %d\n") \
+    X(INIT_END,                   "Ending init\n") \
+    X(SPLIT_REMAINDER,            "math: %d\n") \
+    X(SPLIT_HEADER,               "new block header at %d\n") \
+    X(SPLIT_LINK_NEXT,            "Assigning next_block\n") \
+    X(SPLIT_SET_HEADER,           "Assigning header values\n") \
+    X(SPLIT_UPDATE_NEXT,          "Updating next block\n") \
+    X(SPLIT_ADD_TO_BUCKET,        "Adding to bucket\n") \
+    X(SPLIT_BAD_BUCKET,           "Invalid index for new bucket of size %d\n") \
+    X(ALLOC_START,                "Starting alloc for size: %d, effective_size: %d\n") \
+    X(ALLOC_SPLIT,                "Block size %d is bigger than requested size, splitting\n") \
+    X(ALLOC_END,                  "Ending alloc\n") \
+    X(BAD_ADDRESS,                "ERROR: %d is not an allocated address\n") \
+    X(FREE_START,                 "Starting free address %d\n") \
+    X(FREE_END,                   "Ending free\n") \
+    X(BATCH_ALLOC_START,          "Starting batch alloc of %d blocks of size: %d\n") \
+    X(BATCH_ALLOC_END,            "Ending batch alloc with %d blocks\n") \
+    X(BATCH_FREE_START,           "Starting batch free of %d blocks\n") \
+    X(BATCH_FREE_END,             "Ending batch free\n") \
+    X(REALLOC_GROW,               "Growing into the free block at %d\n") \
+    X(REALLOC_START,              "Starting realloc of %d to size: %d\n") \
+    X(REALLOC_IN_PLACE,           "Ending realloc in place\n") \
+    X(REALLOC_MOVED,              "Ending realloc by moving\n") \
+    X(MEMALIGN_BAD_ALIGNMENT,     "ERROR: can not align to %d bytes\n") \
+    X(MEMALIGN_START,             "Aligning block at %d to %d bytes\n") \
+    X(MEMALIGN_END,               "Ending aligned alloc at %d\n") \
+    X(REMOVE_IS_HEAD,             "Address is a bucket head\n") \
+    X(REMOVE_START,               "Removing address %d from bucket %d\n") \
+    X(UPDATE_NEXT_IN_BUCKET,      "Updating next in bucket at address: %d\n") \
+    X(UPDATE_PREVIOUS_IN_BUCKET,  "Updating previous in bucket at address: %d\n") \
+    X(BUCKET_EMPTY,               "Bucket is empty\n") \
+    X(REMOVE_HEAD_START,          "Removing HEAD address %d from bucket %d\n") \
+    X(REMOVE_HEAD_NOT_HEAD,       "ERROR: block_address is not bucket head\n") \
+    X(REMOVE_HEAD_END,            "Ending remove\n") \
+    X(ADD_START,                  "Adding address %d to bucket %d\n") \
+    X(ADD_NEXT,                   "Next address is %d\n") \
+    X(ADD_NEXT_NULL,              "Next block is null, using short_address: %d\n") \
+    X(ADD_END,                    "Done adding\n") \
+    X(BUCKET_SIZE_TOO_LARGE,      "Size is greater than max size: %d\n") \
+    X(OFFSET_OUT_OF_BOUNDS,       "Memory address out of bounds %d\n") \
+    X(ADDRESS_OUT_OF_BOUNDS,      "ERROR: address is out of bounds\n") \
+    X(SHORTEN_SIZE,               "Shortening block size: %d\n") \
+    X(SHORTEN_SIZE_NOT_CHUNK,     "ERROR size is not a multiple of 32: %d\n") \
+    X(SHORTEN_SIZE_TOO_SMALL,     "ERROR size is less than chunk size\n") \
+    X(CHECK_BAD_BIT_VECTOR,       "ERROR: bit vector does not match the head of bucket %d\n") \
+    X(CHECK_BAD_SIZE,             "ERROR: block at %d with size %d runs past the heap\n") \
+    X(CHECK_BAD_NEXT,             "ERROR: next block link of the block at %d is wrong\n") \
+    X(CHECK_BAD_PREVIOUS,         "ERROR: previous block link of the block at %d is wrong\n") \
+    X(CHECK_BAD_BUCKET_LINKS,     "ERROR: free block at %d is not linked into bucket %d\n") \
+    X(CHECK_ADJACENT_FREE,        "ERROR: free block at %d has a free next block\n") \
+    X(SLAB_RELEASE,               "Releasing empty slab at %d\n") \
+    X(SLAB_NEW,                   "New slab at %d for %d byte slots\n") \
+    X(SLAB_BAD_SLOT,              "ERROR: %d is not an allocated slab slot\n") \
+    X(REGION_ADD,                 "Adding region %d at %d with size %d\n") \
+    X(REGION_BAD,                 "ERROR: can not add a region at %d with size %d\n") \
+    X(REBUILD_END,                "Rebuilt the buckets, %d bytes free, %d blocks joined\n") \
+    X(PERSIST_BAD_IMAGE,          "ERROR: not a heap image of this build, pool size %d\n") \
+    X(PERSIST_REBASE,             "Heap image mapped at %d, was at %d\n") \
+    X(COMPACT_MOVE,               "Moving the block at %d down to %d\n") \
+    X(FIT_TAKE,                   "Taking the fitting block at %d\n")
+
+typedef enum {
+#define HALF_TRACE_ENUM(name, format)  HT_##name,
+    HALF_TRACE_EVENTS(HALF_TRACE_ENUM)
+#undef HALF_TRACE_ENUM
+    HT_COUNT
+} half_event_t;
+
+/**
+ * One event in the ring. Pointer arguments are stored as their low 32 bits
+ */
+typedef struct {
+    // half_cycles() when the event was recorded
+    U32 timestamp;
+    // a half_event_t
+    U16 event;
+    U16 arg_count;
+    U32 args[3];
+} half_trace_record_t;
+
+/**
+ * Written by half_trace_dump in front of the records, oldest record first
+ */
+typedef struct {
+    // half_trace_magic
+    U32 magic;
+    // records that follow
+    U32 record_count;
+    // events recorded since half_trace_init, more than record_count if the ring wrapped
+    U32 total;
+    // sizeof(half_trace_record_t), checked by the decoder
+    U32 record_size;
+} half_trace_dump_header_t;
+
+#define half_trace_arg(arg)  ((U32)(unsigned long)(arg))
+
+#if HALF_TRACE == HALF_TRACE_RING
+
+void half_trace_init( void );
+void half_trace_record( U32 event, U32 arg_count, U32 arg1, U32 arg2, U32 arg3 );
+// Writes a half_trace_dump_header_t and the records to 'out'. Events recorded meanwhile may be torn
+void half_trace_dump( FILE * out );
+
+#define mprint0(event)                    half_trace_record(event, 0, 0, 0, 0)
+#define mprint(event, arg1)               half_trace_record(event, 1, half_trace_arg(arg1), 0, 0)
+#define mprint2(event, arg1, arg2)        half_trace_record(event, 2, half_trace_arg(arg1), half_trace_arg(arg2), 0)
+#define mprint3(event, arg1, arg2, arg3)  half_trace_record(event, 3, half_trace_arg(arg1), half_trace_arg(arg2), half_trace_arg(arg3))
+
+#elif HALF_TRACE == HALF_TRACE_PRINTF
+
+extern const char * const half_trace_formats[HT_COUNT];
+
+#define mprint0(event)                    printf(half_trace_formats[event])
+#define mprint(event, arg1)               printf(half_trace_formats[event], half_trace_arg(arg1))
+#define mprint2(event, arg1, arg2)        printf(half_trace_formats[event], half_trace_arg(arg1), half_trace_arg(arg2))
+#define mprint3(event, arg1, arg2, arg3)  printf(half_trace_formats[event], half_trace_arg(arg1), half_trace_arg(arg2), half_trace_arg(arg3))
+
+#else
+
+#define mprint0(event)                    ((void)0)
+#define mprint(event, arg1)               ((void)0)
+#define mprint2(event, arg1, arg2)        ((void)0)
+#define mprint3(event, arg1, arg2, arg3)  ((void)0)
+
+#endif
+
+#endif
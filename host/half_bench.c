@@ -0,0 +1,297 @@
+/*----------------------------------------------------------------------------
+ * Name:    half_bench.c
+ * Purpose: Single threaded alloc/free latency of the default heap against the
+ *          system malloc, as CSV for tracking regressions between releases
+ * Note(s): Host only. Build with
+ *            cc -std=gnu11 -O2 -Ihost -I. -DHALF_TRACE=0 half_fit.c host/half_bench.c -o half_bench
+ *          adding half_slab.c and -DHALF_SLAB, or other flags, to measure
+ *          those builds. Run as  half_bench [rounds]
+ *          Benchmarks:
+ *            size_class  alloc as many blocks of one bucket as fit (at most
+ *                        64), then free them, for each bucket a block
+ *                        size maps to, 4 sub classes per power of two
+ *            churn       64 byte blocks, a random one of 64 slots is freed
+ *                        if live or allocated if not
+ *            random_mix  the size distribution and alloc/free pattern of
+ *                        test_rndm_alc_free in half_fit_test.c, also
+ *                        reporting the heap's mean fragmentation_percent
+ *                        at the fullest point of each round
+ *          half_fit_best and half_fit_address are the default heap with
+ *          those fit policies. Each call is timed on its own with half_cycles(), converted to
+ *          ns with a calibration against CLOCK_MONOTONIC.
+ *----------------------------------------------------------------------------*/
+
+#include "half_fit.h"
+#include "half_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if HALF_TRACE != HALF_TRACE_OFF
+#error "build with -DHALF_TRACE=0, the trace would be timed too"
+#endif
+
+#define MAX_LIVE     64
+#define MAX_SAMPLES  (1 << 20)
+
+typedef struct {
+    const char *name;
+    void  (*reset)(void);
+    void *(*alloc)(U32 size);
+    void  (*free)(void *address);
+    // NULL if the allocator has no such counter
+    U32   (*fragmentation)(void);
+} allocator_t;
+
+static void half_reset(void) {
+    half_init();
+}
+
+static void half_best_reset(void) {
+    half_init();
+    half_set_fit_policy(HALF_FIT_BEST, fit_scan_default);
+}
+
+static void half_address_reset(void) {
+    half_init();
+    half_set_fit_policy(HALF_FIT_ADDRESS, fit_scan_default);
+}
+
+static U32 half_fragmentation(void) {
+    half_stats_t stats;
+
+    half_get_stats(&stats);
+    return stats.fragmentation_percent;
+}
+
+static void *half_alloc_u32(U32 size) {
+    return half_alloc(size);
+}
+
+static void system_reset(void) {
+}
+
+static void *system_alloc(U32 size) {
+    return malloc(size);
+}
+
+static const allocator_t allocators[] = {
+    { "half_fit", half_reset, half_alloc_u32, half_free, half_fragmentation },
+    { "half_fit_best", half_best_reset, half_alloc_u32, half_free, half_fragmentation },
+    { "half_fit_address", half_address_reset, half_alloc_u32, half_free, half_fragmentation },
+    { "malloc", system_reset, system_alloc, free, NULL },
+};
+
+static U32 samples[MAX_SAMPLES];
+static U32 sample_count;
+static unsigned long failures;
+static double fragmentation_total;
+static U32 fragmentation_count;
+static double ns_per_cycle;
+static unsigned int rounds = 2000;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * Measures how long one half_cycles() tick is over 50 ms
+ */
+static void calibrate(void) {
+    double start_ns = now_ns();
+    U32 start_cycles = half_cycles();
+
+    while (now_ns() - start_ns < 50e6) {
+    }
+    ns_per_cycle = (now_ns() - start_ns) / (double)(U32)(half_cycles() - start_cycles);
+}
+
+static void *timed_alloc(const allocator_t *allocator, U32 size) {
+    U32 start = half_cycles();
+    void *address = allocator->alloc(size);
+    U32 cycles = half_cycles() - start;
+
+    if (sample_count < MAX_SAMPLES) {
+        samples[sample_count++] = cycles;
+    }
+    if (address == NULL) {
+        failures++;
+    }
+    return address;
+}
+
+static void timed_free(const allocator_t *allocator, void *address) {
+    U32 start = half_cycles();
+    U32 cycles;
+
+    allocator->free(address);
+    cycles = half_cycles() - start;
+    if (sample_count < MAX_SAMPLES) {
+        samples[sample_count++] = cycles;
+    }
+}
+
+static int compare_samples(const void *a, const void *b) {
+    U32 first = *(const U32 *)a;
+    U32 second = *(const U32 *)b;
+
+    return (first > second) - (first < second);
+}
+
+static double percentile(double fraction) {
+    return samples[(U32)((double)(sample_count - 1) * fraction)] * ns_per_cycle;
+}
+
+/**
+ * Prints one CSV row for the samples taken since the last call and starts over
+ */
+static void report(const char *benchmark, const allocator_t *allocator, const char *operation, U32 size) {
+    double total = 0;
+    U32 i;
+
+    if (sample_count == 0) {
+        return;
+    }
+    for (i = 0; i < sample_count; i++) {
+        total += samples[i];
+    }
+    qsort(samples, sample_count, sizeof(U32), compare_samples);
+    printf("%s,%s,%s,%u,%u,%.1f,%.1f,%.1f,%.1f,%.1f,%lu,", benchmark, allocator->name, operation, size,
+           sample_count, total * ns_per_cycle / sample_count, percentile(0.5), percentile(0.99),
+           percentile(0.999), samples[sample_count - 1] * ns_per_cycle, failures);
+    if (fragmentation_count > 0) {
+        printf("%.1f", fragmentation_total / fragmentation_count);
+    }
+    printf("\n");
+    sample_count = 0;
+    failures = 0;
+    fragmentation_total = 0;
+    fragmentation_count = 0;
+}
+
+static void bench_size_class(const allocator_t *allocator, U32 bucket) {
+    void *live[MAX_LIVE];
+    // the smallest block of the bucket, as bucket_min_size in half_fit.c
+    U32 block_size = ((((bucket & (sl_cnt - 1)) + sl_cnt) << (bucket >> sl_bits)) >> sl_bits) << smlst_blk;
+    U32 size = block_size - 4;
+    U32 count = lrgst_blk_sz / block_size;
+    U32 round, i;
+
+    // below 4 chunks the sub classes share sizes, only the bucket a size maps to is used
+    if (get_bucket_index(block_size) != (S32)bucket) {
+        return;
+    }
+
+    // a whole number of blocks fits exactly, leave the heap one block of slack
+    count = count > MAX_LIVE ? MAX_LIVE : count > 1 ? count - 1 : 1;
+    allocator->reset();
+
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < count; i++) {
+            live[i] = timed_alloc(allocator, size);
+        }
+        for (i = 0; i < count; i++) {
+            allocator->free(live[i]);
+        }
+    }
+    report("size_class", allocator, "alloc", size);
+
+    for (round = 0; round < rounds; round++) {
+        for (i = 0; i < count; i++) {
+            live[i] = allocator->alloc(size);
+        }
+        for (i = 0; i < count; i++) {
+            timed_free(allocator, live[i]);
+        }
+    }
+    report("size_class", allocator, "free", size);
+}
+
+static void bench_churn(const allocator_t *allocator) {
+    void *live[MAX_LIVE] = { 0 };
+    unsigned int seed = 1;
+    U32 ops = rounds * 100;
+    U32 i, slot;
+
+    allocator->reset();
+    for (i = 0; i < ops; i++) {
+        slot = (U32)rand_r(&seed) % MAX_LIVE;
+        if (live[slot]) {
+            timed_free(allocator, live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = timed_alloc(allocator, 64);
+        }
+    }
+    for (slot = 0; slot < MAX_LIVE; slot++) {
+        if (live[slot]) {
+            allocator->free(live[slot]);
+        }
+    }
+    report("churn", allocator, "mixed", 64);
+}
+
+/**
+ * Sizes from 33 to 32768 bytes, small ones more likely, as get_random_block_size in the test
+ */
+static U32 random_block_size(unsigned int *seed) {
+    U32 r = (U32)rand_r(seed) % ((1 << (lrgst_blk - smlst_blk)) - 1) + 1;
+
+    r = (lrgst_blk - 1) - half_log2_floor(r);
+    return ((U32)rand_r(seed) % (1u << r)) + (1u << r) + 1;
+}
+
+static void bench_random_mix(const allocator_t *allocator) {
+    void *live[200];
+    unsigned int seed = 1;
+    U32 live_count, round, i, victim;
+    void *address;
+
+    allocator->reset();
+    for (round = 0; round < rounds; round++) {
+        live_count = 0;
+        for (i = 0; i < 100; i++) {
+            if ((address = timed_alloc(allocator, random_block_size(&seed))) != NULL) {
+                live[live_count++] = address;
+            }
+        }
+        for (i = 0; i < 50; i++) {
+            if ((rand_r(&seed) & 1) && live_count > 0) {
+                victim = (U32)rand_r(&seed) % live_count;
+                timed_free(allocator, live[victim]);
+                live[victim] = live[--live_count];
+            } else if ((address = timed_alloc(allocator, random_block_size(&seed))) != NULL) {
+                live[live_count++] = address;
+            }
+        }
+        if (allocator->fragmentation) {
+            fragmentation_total += allocator->fragmentation();
+            fragmentation_count++;
+        }
+        while (live_count > 0) {
+            timed_free(allocator, live[--live_count]);
+        }
+    }
+    report("random_mix", allocator, "mixed", 0);
+}
+
+int main(int argc, char **argv) {
+    U32 a, bucket;
+
+    if (argc > 1) {
+        rounds = (unsigned int)strtoul(argv[1], NULL, 10);
+    }
+    calibrate();
+
+    printf("benchmark,allocator,operation,size,ops,ns_per_op,p50_ns,p99_ns,p999_ns,max_ns,failed_allocs,fragmentation_pct\n");
+    for (a = 0; a < sizeof(allocators) / sizeof(allocators[0]); a++) {
+        for (bucket = 0; bucket < bucket_cnt; bucket++) {
+            bench_size_class(&allocators[a], bucket);
+        }
+        bench_churn(&allocators[a]);
+        bench_random_mix(&allocators[a]);
+    }
+    return 0;
+}
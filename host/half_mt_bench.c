@@ -0,0 +1,140 @@
+/*----------------------------------------------------------------------------
+ * Name:    half_mt_bench.c
+ * Purpose: Multi threaded alloc/free throughput of the default heap for
+ *          1 to N threads
+ * Note(s): Host only. Build one of
+ *            cc -std=c11 -O2 -Ihost -I. -DHALF_TRACE=0 -DHALF_CONCURRENT half_fit.c host/half_mt_bench.c -lpthread
+ *            cc -std=c11 -O2 -Ihost -I. -DHALF_TRACE=0 -DHALF_CONCURRENT -DHALF_TCACHE half_fit.c half_tcache.c host/half_mt_bench.c -lpthread
+ *            cc -std=c11 -O2 -Ihost -I. -DHALF_TRACE=0 half_fit.c host/half_mt_bench.c -lpthread
+ *          The last one has no heap locking, so the benchmark wraps every
+ *          call in one global lock to give the single lock baseline.
+ *          Run as  half_mt_bench [max_threads] [ops_per_thread]
+ *----------------------------------------------------------------------------*/
+
+// clock_gettime, CLOCK_MONOTONIC and rand_r under -std=c11
+#define _POSIX_C_SOURCE 200809L
+
+#include "half_fit.h"
+#ifdef HALF_TCACHE
+#include "half_tcache.h"
+#endif
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// live blocks per thread, small enough that 16 threads fit in the 32 kB pool
+#define WORKING_SET  8
+
+#ifndef HALF_CONCURRENT
+static pthread_mutex_t heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define lock_heap()    pthread_mutex_lock(&heap_mutex)
+#define unlock_heap()  pthread_mutex_unlock(&heap_mutex)
+#else
+#define lock_heap()
+#define unlock_heap()
+#endif
+
+typedef struct {
+    unsigned int seed;
+    unsigned long ops;
+    unsigned long failures;
+} worker_t;
+
+static unsigned long ops_per_thread = 200000;
+
+/**
+ * Mixed sizes: mostly under 128 bytes, one in eight up to 512 bytes
+ */
+static U32 random_size(unsigned int *seed) {
+    U32 r = (U32)rand_r(seed);
+    if ((r & 7) == 0) {
+        return (r >> 3) % 512 + 1;
+    }
+    return (r >> 3) % 128 + 1;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *worker = (worker_t *)arg;
+    void *live[WORKING_SET] = { 0 };
+    unsigned long i;
+    U32 slot;
+
+    for (i = 0; i < ops_per_thread; i++) {
+        slot = (U32)rand_r(&worker->seed) % WORKING_SET;
+        lock_heap();
+        if (live[slot]) {
+            half_free(live[slot]);
+            live[slot] = NULL;
+        } else {
+            live[slot] = half_alloc(random_size(&worker->seed));
+            if (live[slot] == NULL) {
+                worker->failures++;
+            }
+        }
+        unlock_heap();
+        worker->ops++;
+    }
+
+    lock_heap();
+    for (slot = 0; slot < WORKING_SET; slot++) {
+        half_free(live[slot]);
+    }
+    unlock_heap();
+#ifdef HALF_TCACHE
+    half_tcache_flush();
+#endif
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv) {
+    int max_threads = argc > 1 ? atoi(argv[1]) : 16;
+    int threads, i;
+    pthread_t ids[64];
+    worker_t workers[64];
+    unsigned long ops, failures;
+    double start, elapsed;
+
+    if (argc > 2) {
+        ops_per_thread = strtoul(argv[2], NULL, 10);
+    }
+    if (max_threads < 1 || max_threads > 64) {
+        fprintf(stderr, "max_threads must be 1-64\n");
+        return 1;
+    }
+
+    // stdout carries the allocator's trace when HALF_TRACE prints it, the results go to stderr
+    fprintf(stderr, "threads,ops,seconds,ops_per_sec,failed_allocs\n");
+    for (threads = 1; threads <= max_threads; threads++) {
+        half_init();
+        for (i = 0; i < threads; i++) {
+            workers[i].seed = (unsigned int)(i + 1);
+            workers[i].ops = 0;
+            workers[i].failures = 0;
+        }
+
+        start = now_seconds();
+        for (i = 0; i < threads; i++) {
+            pthread_create(&ids[i], NULL, worker_main, &workers[i]);
+        }
+        for (i = 0; i < threads; i++) {
+            pthread_join(ids[i], NULL);
+        }
+        elapsed = now_seconds() - start;
+
+        ops = 0;
+        failures = 0;
+        for (i = 0; i < threads; i++) {
+            ops += workers[i].ops;
+            failures += workers[i].failures;
+        }
+        fprintf(stderr, "%d,%lu,%.4f,%.0f,%lu\n", threads, ops, elapsed, (double)ops / elapsed, failures);
+    }
+    return 0;
+}
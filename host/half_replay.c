@@ -0,0 +1,310 @@
+/*----------------------------------------------------------------------------
+ * Name:    half_replay.c
+ * Purpose: Runs a capture written by half_capture_start (HALF_CAPTURE) against
+ *          the default heap again, and reports where the replay handed out
+ *          other offsets than the capture, the time spent in the allocator,
+ *          peak usage and failed allocations
+ * Note(s): Host only. Build with the flags the capture was made with, eg.
+ *            cc -std=gnu11 -O2 -Ihost -I. -DHALF_TRACE=0 half_fit.c host/half_replay.c -o half_replay
+ *          adding half_slab.c and -DHALF_SLAB for a slab build. Run as
+ *            half_replay [capture_file]
+ *          Reads stdin without a file. A replay built with different flags,
+ *          or from a changed allocator, still runs: addresses are mapped from
+ *          the captured offsets, and every call that returned another offset
+ *          is counted. The first few are listed on stderr.
+ *          Exits with 1 if the replay did not map identically.
+ *----------------------------------------------------------------------------*/
+
+#include "half_fit.h"
+#include "half_capture.h"
+#include "half_port.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define MAX_LISTED  10
+#define MAX_BATCH   0x10000
+
+static const char * const op_names[HC_COUNT] = {
+    "init", "alloc", "free", "realloc", "memalign", "alloc_batch", "free_batch"
+};
+
+typedef struct {
+    U32 calls;
+    double cycles;
+    U32 failed;
+    U32 captured_failed;
+} op_stats_t;
+
+// the replayed address of every captured offset that is allocated, one per byte of total_size
+static void ** live;
+static U32 live_size;
+static void * batch[MAX_BATCH];
+static op_stats_t op_stats[HC_COUNT];
+static U32 mismatches;
+static U32 unknown_frees;
+static U32 peak_used_bytes;
+static U32 size_mismatches;
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/**
+ * Measures how long one half_cycles() tick is over 50 ms
+ */
+static double calibrate(void) {
+    double start_ns = now_ns();
+    U32 start_cycles = half_cycles();
+
+    while (now_ns() - start_ns < 50e6) {
+    }
+    return (now_ns() - start_ns) / (double)(U32)(half_cycles() - start_cycles);
+}
+
+static int compare_sequence(const void *a, const void *b) {
+    U32 first = ((const half_capture_record_t *)a)->sequence;
+    U32 second = ((const half_capture_record_t *)b)->sequence;
+
+    return (first > second) - (first < second);
+}
+
+/**
+ * Maps a captured offset to the replayed address, NULL for half_capture_null
+ */
+static void * lookup(const half_capture_record_t *record, U32 offset) {
+    if (offset == half_capture_null) {
+        return NULL;
+    }
+    if (offset >= live_size || live[offset] == NULL) {
+        if (unknown_frees++ < MAX_LISTED) {
+            fprintf(stderr, "#%u %s: offset %u was not allocated in the replay\n", record->sequence,
+                    op_names[record->op], offset);
+        }
+        return NULL;
+    }
+    return live[offset];
+}
+
+/**
+ * Compares the result of a call that hands out memory with the capture and remembers it
+ */
+static void returned(const half_capture_record_t *record, void * address) {
+    U32 offset = half_capture_offset(address);
+
+    if (address == NULL) {
+        op_stats[record->op].failed++;
+    }
+    if (record->offset == half_capture_null) {
+        op_stats[record->op].captured_failed++;
+    }
+    if (offset != record->offset && mismatches++ < MAX_LISTED) {
+        fprintf(stderr, "#%u %s of %u bytes: captured offset %d, replayed %d\n", record->sequence,
+                op_names[record->op], (U32)record->size, (int)record->offset, (int)offset);
+    }
+    if (address && record->offset < live_size) {
+        live[record->offset] = address;
+    }
+}
+
+static void forget(U32 offset) {
+    if (offset < live_size) {
+        live[offset] = NULL;
+    }
+}
+
+static void update_peak(void) {
+    half_stats_t stats;
+
+    half_get_stats(&stats);
+    if (stats.peak_used_bytes > peak_used_bytes) {
+        peak_used_bytes = stats.peak_used_bytes;
+    }
+}
+
+/**
+ * Replays the record at 'records', and the rest of its batch
+ * @return Number of records used
+ */
+static U32 replay(const half_capture_record_t *records, U32 remaining) {
+    const half_capture_record_t *record = records;
+    U32 count = record->argument & 0xFFFF;
+    U32 used = 1;
+    U32 start, cycles;
+    U32 i, allocated, captured;
+    void * old_address;
+    void * address;
+
+    switch (record->op) {
+    case HC_INIT:
+        update_peak();
+        start = half_cycles();
+        half_init();
+        cycles = half_cycles() - start;
+        if (record->size != half_default_heap.total_size && size_mismatches++ == 0) {
+            fprintf(stderr, "#%u init: captured with a %u byte heap, replaying on %u bytes\n", record->sequence,
+                    (U32)record->size, half_default_heap.total_size);
+        }
+        for (i = 0; i < live_size; i++) {
+            live[i] = NULL;
+        }
+        break;
+    case HC_ALLOC:
+        start = half_cycles();
+        address = half_alloc(record->size);
+        cycles = half_cycles() - start;
+        returned(record, address);
+        break;
+    case HC_FREE:
+        address = lookup(record, record->offset);
+        start = half_cycles();
+        half_free(address);
+        cycles = half_cycles() - start;
+        forget(record->offset);
+        break;
+    case HC_REALLOC:
+        old_address = lookup(record, record->argument);
+        start = half_cycles();
+        address = half_realloc(old_address, record->size);
+        cycles = half_cycles() - start;
+        // the old block is gone unless a resize failed
+        if (address || record->size == 0) {
+            forget(record->argument);
+        }
+        if (record->size != 0 || old_address == NULL) {
+            returned(record, address);
+        }
+        break;
+    case HC_MEMALIGN:
+        start = half_cycles();
+        address = half_memalign(record->argument, record->size);
+        cycles = half_cycles() - start;
+        returned(record, address);
+        break;
+    case HC_ALLOC_BATCH:
+        // the capture has one record per block that was handed out
+        while (used < remaining && records[used].op == HC_ALLOC_BATCH && (records[used].argument >> 16) == used) {
+            used++;
+        }
+        // or a single NULL one if there was none
+        captured = record->offset == half_capture_null ? 0 : used;
+        start = half_cycles();
+        allocated = half_alloc_batch(record->size, count, batch);
+        cycles = half_cycles() - start;
+        for (i = 0; i < captured && i < allocated; i++) {
+            returned(&records[i], batch[i]);
+        }
+        if (allocated != captured && mismatches++ < MAX_LISTED) {
+            fprintf(stderr, "#%u alloc_batch of %u blocks: captured %u blocks, replayed %u\n",
+                    record->sequence, count, captured, allocated);
+        }
+        // blocks the capture did not get are of no use to later records
+        for (i = captured; i < allocated; i++) {
+            half_free(batch[i]);
+        }
+        if (allocated < count) {
+            op_stats[HC_ALLOC_BATCH].failed++;
+        }
+        if (captured < count) {
+            op_stats[HC_ALLOC_BATCH].captured_failed++;
+        }
+        break;
+    case HC_FREE_BATCH:
+        while (used < remaining && used < count && records[used].op == HC_FREE_BATCH) {
+            used++;
+        }
+        for (i = 0; i < used; i++) {
+            batch[i] = lookup(&records[i], records[i].offset);
+            forget(records[i].offset);
+        }
+        start = half_cycles();
+        half_free_batch(batch, used);
+        cycles = half_cycles() - start;
+        break;
+    default:
+        fprintf(stderr, "#%u: unknown op %u\n", record->sequence, (U32)record->op);
+        return 1;
+    }
+
+    op_stats[record->op].calls++;
+    op_stats[record->op].cycles += cycles;
+    return used;
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    half_capture_header_t header;
+    half_capture_record_t *records;
+    U32 capacity = 1024;
+    U32 count = 0;
+    U32 i;
+    U32 total_calls = 0;
+    double total_cycles = 0;
+    double ns_per_cycle;
+
+    if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 2;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != half_capture_magic) {
+        fprintf(stderr, "not a half_capture file\n");
+        return 2;
+    }
+    if (header.record_size != sizeof(half_capture_record_t)) {
+        fprintf(stderr, "records are %u bytes, expected %u\n", header.record_size, (unsigned int)sizeof(half_capture_record_t));
+        return 2;
+    }
+
+    records = malloc(capacity * sizeof(half_capture_record_t));
+    while (records && fread(&records[count], sizeof(half_capture_record_t), 1, in) == 1) {
+        if (++count == capacity) {
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(half_capture_record_t));
+        }
+    }
+    if (records == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    // threads may have written their records out of order
+    qsort(records, count, sizeof(half_capture_record_t), compare_sequence);
+
+    ns_per_cycle = calibrate();
+    half_init();
+    live_size = half_default_heap.total_size;
+    if ((live = calloc(live_size, sizeof(void *))) == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 2;
+    }
+    // the HC_INIT records are checked as they are replayed
+    if (count > 0 && records[0].op != HC_INIT) {
+        fprintf(stderr, "the capture started after half_init, offsets will differ if the heap was in use\n");
+        if (header.heap_size != half_default_heap.total_size) {
+            fprintf(stderr, "captured with a %u byte heap, replaying on %u bytes\n", header.heap_size, half_default_heap.total_size);
+        }
+    }
+
+    for (i = 0; i < count; ) {
+        i += replay(&records[i], count - i);
+    }
+    update_peak();
+
+    printf("%u records\n", count);
+    printf("%-12s %10s %10s %12s %14s\n", "op", "calls", "ns/call", "failed", "failed before");
+    for (i = 0; i < HC_COUNT; i++) {
+        if (op_stats[i].calls == 0) {
+            continue;
+        }
+        printf("%-12s %10u %10.1f %12u %14u\n", op_names[i], op_stats[i].calls,
+               op_stats[i].cycles * ns_per_cycle / op_stats[i].calls, op_stats[i].failed, op_stats[i].captured_failed);
+        total_calls += op_stats[i].calls;
+        total_cycles += op_stats[i].cycles;
+    }
+    printf("total time %.0f ns in %u calls\n", total_cycles * ns_per_cycle, total_calls);
+    printf("peak used %u of %u bytes\n", peak_used_bytes, half_default_heap.total_size);
+    printf("%u offsets differ from the capture, %u frees of addresses not allocated in the replay\n",
+           mismatches, unknown_frees);
+    return mismatches || unknown_frees ? 1 : 0;
+}
@@ -0,0 +1,71 @@
+/*----------------------------------------------------------------------------
+ * Name:    half_trace_decode.c
+ * Purpose: Formats a ring buffer written by half_trace_dump (HALF_TRACE set to
+ *          HALF_TRACE_RING) as text, one event per line, oldest first
+ * Note(s): Host only. Build with
+ *            cc -std=c11 -O2 -Ihost -I. host/half_trace_decode.c -o half_trace_decode
+ *          Run as  half_trace_decode [dump_file]
+ *          Reads stdin without a file, eg. a capture of the UART when the
+ *          target called half_trace_dump(stdout). Each line shows the cycle
+ *          count since the first record and since the previous one.
+ *----------------------------------------------------------------------------*/
+
+#include "half_trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static const char * const formats[HT_COUNT] = {
+#define HALF_TRACE_FORMAT(name, format)  format,
+    HALF_TRACE_EVENTS(HALF_TRACE_FORMAT)
+#undef HALF_TRACE_FORMAT
+};
+
+static const char * const names[HT_COUNT] = {
+#define HALF_TRACE_NAME(name, format)  #name,
+    HALF_TRACE_EVENTS(HALF_TRACE_NAME)
+#undef HALF_TRACE_NAME
+};
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    half_trace_dump_header_t header;
+    half_trace_record_t record;
+    unsigned int i;
+    U32 first = 0;
+    U32 previous = 0;
+
+    if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    if (fread(&header, sizeof(header), 1, in) != 1 || header.magic != half_trace_magic) {
+        fprintf(stderr, "not a half_trace dump\n");
+        return 1;
+    }
+    if (header.record_size != sizeof(half_trace_record_t)) {
+        fprintf(stderr, "records are %u bytes, expected %u\n", header.record_size, (unsigned int)sizeof(half_trace_record_t));
+        return 1;
+    }
+    printf("# %u events recorded, the last %u follow\n", header.total, header.record_count);
+
+    for (i = 0; i < header.record_count; i++) {
+        if (fread(&record, sizeof(record), 1, in) != 1) {
+            fprintf(stderr, "dump ends after %u records\n", i);
+            return 1;
+        }
+        if (i == 0) {
+            first = previous = record.timestamp;
+        }
+        // unsigned differences stay right across one wrap of the counter
+        printf("%10u %+8d  ", record.timestamp - first, (int)(record.timestamp - previous));
+        previous = record.timestamp;
+
+        if (record.event >= HT_COUNT) {
+            printf("unknown event %u\n", record.event);
+            continue;
+        }
+        printf("%-26s ", names[record.event]);
+        printf(formats[record.event], record.args[0], record.args[1], record.args[2]);
+    }
+    return 0;
+}
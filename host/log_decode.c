@@ -0,0 +1,115 @@
+/*----------------------------------------------------------------------------
+ * Name:    log_decode.c
+ * Purpose: Formats the records LogDrain (Log.c) sent on the UART as text
+ * Note(s): Host only. Build with
+ *            cc -std=c11 -O2 -I. host/log_decode.c -o log_decode
+ *          Run as  log_decode [capture_file]
+ *          Reads stdin without a file, eg. the serial port itself. Bytes
+ *          outside records, the program's own printf output, are copied
+ *          through as they are. The decoder must be built with the same
+ *          LOG_MESSAGES as the firmware.
+ *----------------------------------------------------------------------------*/
+
+#include "Log.h"
+#include <stdio.h>
+
+static const char * const formats[LOG_COUNT] = {
+#define LOG_FORMAT(name, format)  format,
+    LOG_MESSAGES(LOG_FORMAT)
+#undef LOG_FORMAT
+};
+
+/**
+ * Reads one unsigned LEB128 number
+ * @return 1, 0 at the end of the input, -1 if the number runs past 5 bytes. The byte that
+ *         would have been the 6th is left unread
+ */
+static int read_number(FILE *in, uint32_t *value) {
+    uint32_t shift = 0;
+    int byte;
+
+    *value = 0;
+    do {
+        if ((byte = getc(in)) == EOF) {
+            return 0;
+        }
+        if (shift > 28) {
+            ungetc(byte, in);
+            return -1;
+        }
+        *value |= (uint32_t)(byte & 0x7F) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    return 1;
+}
+
+/**
+ * Drops the bytes of a broken record, up to the next LOG_SYNC, which is left unread. Noise on
+ * the line then costs the records it hit, not the rest of the input
+ */
+static void skip_to_sync(FILE *in) {
+    int byte;
+
+    while ((byte = getc(in)) != EOF && byte != LOG_SYNC) {
+    }
+    if (byte != EOF) {
+        ungetc(byte, in);
+    }
+}
+
+int main(int argc, char **argv) {
+    FILE *in = stdin;
+    uint32_t records = 0;
+    uint32_t head, id, i;
+    uint32_t count = 0;
+    uint32_t args[LOG_MAX_ARGS];
+    int byte;
+    int read = 1;
+
+    if (argc > 1 && (in = fopen(argv[1], "rb")) == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    while ((byte = getc(in)) != EOF) {
+        if (byte != LOG_SYNC) {
+            putchar(byte);
+            continue;
+        }
+        if ((read = read_number(in, &head)) == 1) {
+            count = head & 0x07;
+            if (count > LOG_MAX_ARGS) {
+                read = -1;
+            }
+            for (i = 0; read == 1 && i < count; i++) {
+                read = read_number(in, &args[i]);
+            }
+        }
+        if (read == 0) {
+            break;
+        }
+        if (read < 0) {
+            printf("[log: bad record after %u records]\n", records);
+            skip_to_sync(in);
+            continue;
+        }
+        id = head >> 3;
+        for (i = count; i < LOG_MAX_ARGS; i++) {
+            args[i] = 0;
+        }
+        records++;
+
+        if (id >= LOG_COUNT) {
+            // firmware newer than the decoder
+            printf("[log: unknown message %u]\n", id);
+            continue;
+        }
+        printf(formats[id], args[0], args[1], args[2], args[3]);
+        fflush(stdout);
+    }
+    if (read == 0) {
+        fprintf(stderr, "input ends inside a record, after %u records\n", records);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*----------------------------------------------------------------------------
+ * Name:    lpc17xx.h (host)
+ * Purpose: Stand-in for the LPC17xx device header when building on a desktop
+ *          machine. Only the parts used by the allocator and by uart.c are
+ *          provided. The UARTs are simulated by host/uart_sim.c
+ * Note(s): Put this directory first on the include path of host builds only,
+ *          eg.  cc -std=c11 -Ihost -I. -DHALF_TCACHE -c half_fit.c half_tcache.c
+ *----------------------------------------------------------------------------*/
+
+#ifndef __LPC17xx_H__
+#define __LPC17xx_H__
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Lets shared sources pick the host variant of target specific code
+#define LPC17XX_HOST 1
+
+extern uint32_t SystemCoreClock;
+
+typedef enum {
+    UART0_IRQn = 5,
+    UART1_IRQn = 6
+} IRQn_Type;
+
+/*
+ * A UART. Registers that do something when they are accessed are reached through a function
+ * that host/uart_sim.c provides per UART: the THR, RBR, LSR, IIR and FCR macros below turn
+ * LPC_UART->THR = c into LPC_UART->thr_()[0] = c. The function brings the simulated UART up to
+ * date, applies the side effect and returns the register's storage for the access itself.
+ * The other registers are plain memory that the simulator reads.
+ */
+typedef struct {
+    volatile uint32_t *(*thr_)(void);
+    volatile uint32_t *(*rbr_)(void);
+    volatile uint32_t *(*lsr_)(void);
+    volatile uint32_t *(*iir_)(void);
+    volatile uint32_t *(*fcr_)(void);
+    volatile uint32_t DLL;
+    volatile uint32_t DLM;
+    volatile uint32_t IER;
+    volatile uint32_t LCR;
+    volatile uint32_t MCR;
+    volatile uint32_t SCR;
+} LPC_UART_TypeDef;
+
+typedef LPC_UART_TypeDef LPC_UART1_TypeDef;
+
+#define THR  thr_()[0]
+#define RBR  rbr_()[0]
+#define LSR  lsr_()[0]
+#define IIR  iir_()[0]
+#define FCR  fcr_()[0]
+
+typedef struct {
+    volatile uint32_t PINSEL0;
+    volatile uint32_t PINSEL4;
+} LPC_PINCON_TypeDef;
+
+typedef struct {
+    volatile uint32_t PCLKSEL0;
+} LPC_SC_TypeDef;
+
+extern LPC_UART_TypeDef uart_sim_regs[2];
+extern LPC_PINCON_TypeDef uart_sim_pincon;
+extern LPC_SC_TypeDef uart_sim_sc;
+
+#define LPC_UART0   (&uart_sim_regs[0])
+#define LPC_UART1   ((LPC_UART1_TypeDef *)&uart_sim_regs[1])
+#define LPC_PINCON  (&uart_sim_pincon)
+#define LPC_SC      (&uart_sim_sc)
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+
+// Exclusive access to a lock byte. Interrupts are simulated on the one thread, so a plain
+// read and write is exclusive
+static inline uint32_t __LDREXW(volatile void *address) {
+    return *(volatile uint8_t *)address;
+}
+
+static inline uint32_t __STREXW(uint32_t value, volatile void *address) {
+    *(volatile uint8_t *)address = (uint8_t)value;
+    return 0;
+}
+
+#define __NOP()  ((void)0)
+
+// PRIMASK. host/uart_sim.c holds its interrupts back while it is set
+extern volatile uint32_t uart_sim_primask;
+
+static inline uint32_t __get_PRIMASK(void) {
+    return uart_sim_primask;
+}
+
+static inline void __set_PRIMASK(uint32_t priMask) {
+    uart_sim_primask = priMask;
+}
+
+static inline void __disable_irq(void) {
+    uart_sim_primask = 1;
+}
+
+static inline void __enable_irq(void) {
+    uart_sim_primask = 0;
+}
+
+// The debug channel used when printf is not retargeted to a UART
+#define ITM_RXBUFFER_EMPTY  0x5AA55AA5
+
+static inline uint32_t ITM_SendChar(uint32_t ch) {
+    putchar((int)ch);
+    return ch;
+}
+
+static inline int ITM_CheckChar(void) {
+    return 0;
+}
+
+static inline int ITM_ReceiveChar(void) {
+    return -1;
+}
+
+#endif  /* __LPC17xx_H__ */
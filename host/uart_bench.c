@@ -0,0 +1,170 @@
+/*----------------------------------------------------------------------------
+ * Name:    uart_bench.c
+ * Purpose: Runs uart.c against the simulated UARTs of uart_sim.c and reports
+ *          throughput, interrupts per byte and the time the caller spends
+ *          waiting in UARTSend and UARTRecieve
+ * Note(s): Host only. Build with
+ *            cc -std=gnu11 -O2 -Ihost -I. uart.c host/uart_sim.c host/uart_bench.c -o uart_bench -lrt
+ *          Run as  uart_bench [baud] [bytes] [send|loopback|all]
+ *          "send" hands UARTSend of UART0 one 64 byte block per block time,
+ *          and does other work in between, as a program that prints a line
+ *          now and then. "loopback" connects UART0 to UART1, sends as fast
+ *          as the line goes and reads everything back with UARTRecieve and
+ *          checks it. Wait time is the time
+ *          spent in the calls minus the interrupt handlers that ran meanwhile.
+ *----------------------------------------------------------------------------*/
+
+#include "lpc17xx.h"
+#include "uart.h"
+#include "uart_sim.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BLOCK       64
+#define MAX_TICK_NS 50000
+
+typedef struct {
+    uint64_t ns;
+    uint64_t calls;
+} wait_t;
+
+static uint8_t pattern[BLOCK];
+
+/**
+ * Time spent in the call that ran from 'start' to now, without interrupt handlers
+ */
+static void waited(wait_t *wait, uint64_t start, uint64_t irq_start) {
+    wait->ns += (uart_sim_now() - start) - (uart_sim_irq_ns() - irq_start);
+    wait->calls++;
+}
+
+static void send(wait_t *wait, uint8_t *data, uint32_t length) {
+    uint64_t start = uart_sim_now();
+    uint64_t irq_start = uart_sim_irq_ns();
+
+    UARTSend(0, data, length);
+    waited(wait, start, irq_start);
+}
+
+static uint32_t receive(wait_t *wait, uint8_t *data, uint32_t length) {
+    uint64_t start = uart_sim_now();
+    uint64_t irq_start = uart_sim_irq_ns();
+    uint32_t received = UARTRecieve(1, data, length);
+
+    waited(wait, start, irq_start);
+    return received;
+}
+
+static void report(const char *name, uint32_t baud, uint32_t bytes, uint64_t elapsed_ns,
+                   const wait_t *send_wait, const wait_t *receive_wait) {
+    uart_sim_stats_t tx, rx;
+    double line_rate = 1e9 / (double)uart_sim_char_ns(0);
+
+    uart_sim_get_stats(0, &tx);
+    uart_sim_get_stats(1, &rx);
+    printf("%s at %u baud, %u bytes\n", name, baud, bytes);
+    printf("  throughput      %10.0f bytes/s, %.1f%% of the line rate\n",
+           bytes * 1e9 / elapsed_ns, 100.0 * bytes * 1e9 / elapsed_ns / line_rate);
+    printf("  interrupts      %10.3f per byte sent (UART0), %.3f per byte received (UART1)\n",
+           (double)tx.interrupts / bytes, rx.rx_bytes ? (double)rx.interrupts / rx.rx_bytes : 0.0);
+    printf("  in handlers     %10.1f%% of the time\n", 100.0 * (tx.irq_ns + rx.irq_ns) / elapsed_ns);
+    printf("  UARTSend        %10.0f ns waiting per byte, %.1f%% of the time\n",
+           (double)send_wait->ns / bytes, 100.0 * send_wait->ns / elapsed_ns);
+    if (receive_wait) {
+        printf("  UARTRecieve     %10.0f ns waiting per byte, %.1f%% of the time\n",
+               (double)receive_wait->ns / bytes, 100.0 * receive_wait->ns / elapsed_ns);
+    }
+    printf("  lost            %10u in the RX FIFO, %u in the THR FIFO\n", rx.rx_overruns, tx.tx_overflows);
+}
+
+/**
+ * One block per block time, like a program that prints now and then
+ */
+static void bench_send(uint32_t baud, uint32_t bytes) {
+    wait_t send_wait = { 0, 0 };
+    uint64_t block_ns = BLOCK * uart_sim_char_ns(0);
+    uint64_t start;
+    uint32_t sent = 0;
+
+    // nobody reads UART1 here
+    uart_sim_connect(0, -1);
+    uart_sim_clear_stats();
+    start = uart_sim_now();
+
+    while (sent < bytes) {
+        send(&send_wait, pattern, BLOCK);
+        sent += BLOCK;
+        // the rest of the block time is the program's own work
+        while (uart_sim_now() - start < (uint64_t)(sent / BLOCK) * block_ns) {
+        }
+    }
+    while (!uart_sim_tx_idle(0)) {
+    }
+    report("send", baud, sent, uart_sim_now() - start, &send_wait, NULL);
+}
+
+/**
+ * Sends and reads back as fast as the line goes, checking every byte
+ */
+static int bench_loopback(uint32_t baud, uint32_t bytes) {
+    static uint8_t buffer[TX_BUFSIZE];
+    wait_t send_wait = { 0, 0 };
+    wait_t receive_wait = { 0, 0 };
+    uint64_t start;
+    uint32_t sent = 0, received = 0, wrong = 0;
+    uint32_t i, n;
+
+    uart_sim_connect(0, 1);
+    uart_sim_clear_stats();
+    start = uart_sim_now();
+
+    while (received < bytes) {
+        // two blocks ahead, so the line never waits for the reader
+        while (sent < bytes && sent - received < 2 * BLOCK) {
+            send(&send_wait, pattern, BLOCK);
+            sent += BLOCK;
+        }
+        n = receive(&receive_wait, buffer, sizeof(buffer));
+        for (i = 0; i < n; i++) {
+            wrong += buffer[i] != pattern[(received + i) % BLOCK];
+        }
+        received += n;
+    }
+    report("loopback", baud, received, uart_sim_now() - start, &send_wait, &receive_wait);
+    if (wrong) {
+        printf("  %u bytes came back wrong\n", wrong);
+    }
+    return wrong == 0;
+}
+
+int main(int argc, char **argv) {
+    uint32_t baud = argc > 1 ? (uint32_t)atoi(argv[1]) : 115200;
+    uint32_t bytes = argc > 2 ? (uint32_t)atoi(argv[2]) : 8192;
+    const char *phases = argc > 3 ? argv[3] : "all";
+    uint32_t i;
+    int ok = 1;
+
+    for (i = 0; i < BLOCK; i++) {
+        pattern[i] = (uint8_t)(i * 37 + 1);
+    }
+    bytes = (bytes + BLOCK - 1) / BLOCK * BLOCK;
+
+    UARTInit(0, baud);
+    UARTInit(1, baud);
+    if (!uart_sim_start(MAX_TICK_NS)) {
+        perror("uart_sim_start");
+        return 2;
+    }
+    // both phases take about the line time, a driver that loses bytes never finishes
+    uart_sim_deadline(uart_sim_now() + 4 * bytes * uart_sim_char_ns(0) + 1000000000u);
+
+    if (strcmp(phases, "loopback") != 0) {
+        bench_send(baud, bytes);
+    }
+    if (strcmp(phases, "send") != 0) {
+        ok = bench_loopback(baud, bytes);
+    }
+    uart_sim_stop();
+    return ok ? 0 : 1;
+}
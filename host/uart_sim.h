@@ -0,0 +1,58 @@
+/*----------------------------------------------------------------------------
+ * Name:    uart_sim.h
+ * Purpose: Simulated UART0 and UART1 behind the host lpc17xx.h, so uart.c
+ *          runs unchanged on a PC
+ * Note(s): Each UART has a 16 byte THR and RBR FIFO, the LSR and IIR bits
+ *          uart.c reads, and a shift register that takes one character time
+ *          at the programmed baud rate per byte. A timer signal stands in for
+ *          the interrupt source. It preempts the program like an interrupt
+ *          and calls UART0_IRQHandler / UART1_IRQHandler, while the NVIC line
+ *          is enabled and the IER and IIR say so.
+ *          Host only and single threaded: only the main thread may call
+ *          uart.c.
+ *----------------------------------------------------------------------------*/
+
+#ifndef __UART_SIM_H
+#define __UART_SIM_H
+
+#include <stdint.h>
+
+typedef struct {
+    // calls of the port's interrupt handler
+    uint32_t interrupts;
+    // bytes shifted out on the TX line
+    uint32_t tx_bytes;
+    // bytes written to a full THR FIFO, they are lost
+    uint32_t tx_overflows;
+    // bytes that arrived in the RX FIFO
+    uint32_t rx_bytes;
+    // bytes that arrived while the RX FIFO was full, they are lost
+    uint32_t rx_overruns;
+    // time spent in the port's interrupt handler
+    uint64_t irq_ns;
+} uart_sim_stats_t;
+
+// Sends what 'from_port' transmits to the RX line of 'to_port', -1 to drop it. Nothing is
+// connected at first, 0 to 0 is a loopback
+void     uart_sim_connect( uint32_t from_port, int to_port );
+// Starts the simulated interrupt source. It fires at the next event of the UARTs, at the latest
+// every 'max_tick_ns' nanoseconds
+int      uart_sim_start( uint32_t max_tick_ns );
+void     uart_sim_stop( void );
+// Exits the program with a message if it still runs at uart_sim_now() 'deadline_ns'
+void     uart_sim_deadline( uint64_t deadline_ns );
+// Puts a byte on the RX line of a port now, 'line_errors' is LSR_FE, LSR_PE, LSR_BI or 0
+void     uart_sim_inject( uint32_t port, uint8_t byte, uint32_t line_errors );
+
+// CLOCK_MONOTONIC in nanoseconds, the simulator's time
+uint64_t uart_sim_now( void );
+// Time of one character at the port's current divisor and line format, 0 if it has none
+uint64_t uart_sim_char_ns( uint32_t port );
+// Nothing left in the THR FIFO or the shift register of the port
+int      uart_sim_tx_idle( uint32_t port );
+// Time spent in the interrupt handlers of both ports so far
+uint64_t uart_sim_irq_ns( void );
+void     uart_sim_get_stats( uint32_t port, uart_sim_stats_t *stats );
+void     uart_sim_clear_stats( void );
+
+#endif
@@ -27,9 +27,21 @@ volatile int ITM_RxBuffer = ITM_RXBUFFER_EMPTY;  /*  CMSIS Debug Input        */
 //#endif
 
 volatile uint32_t UART0Status, UART1Status;
-volatile uint8_t UART0TxEmpty = 1, UART1TxEmpty = 1;
-volatile uint8_t UART0Buffer[BUFSIZE], UART1Buffer[BUFSIZE];
-volatile uint32_t UART0Count = 0, UART1Count = 0;
+/* Receive rings, filled by the interrupt handler and emptied by one reader
+   without a lock. The head counts the bytes received and is only written by
+   the handler, the tail counts the bytes read and is only written by the
+   reader. Both only count up, the ring index is the count modulo RX_BUFSIZE */
+volatile uint8_t UART0RxBuffer[RX_BUFSIZE], UART1RxBuffer[RX_BUFSIZE];
+volatile uint32_t UART0RxHead = 0, UART1RxHead = 0;
+volatile uint32_t UART0RxTail = 0, UART1RxTail = 0;
+volatile UART_RX_ERRORS UART0RxErrors, UART1RxErrors;
+
+/* Transmit rings. The head counts the bytes queued by the sender and the
+   tail the bytes the THRE interrupt moved into the FIFO. Both only count
+   up, the ring index is the count modulo TX_BUFSIZE */
+volatile uint8_t UART0TxBuffer[TX_BUFSIZE], UART1TxBuffer[TX_BUFSIZE];
+volatile uint32_t UART0TxHead = 0, UART1TxHead = 0;
+volatile uint32_t UART0TxTail = 0, UART1TxTail = 0;
 
 volatile uint8_t RcvLock0; 
 volatile uint8_t SndLock0; 
@@ -77,6 +89,94 @@ void FreeSnd(uint8_t portNum){
 	Free( portNum == 0? &SndLock0 : &SndLock1 );
 }
 
+/*****************************************************************************
+** Function name:		UARTRxDrain
+**
+** Descriptions:		Move every byte in the RX FIFO into the receive ring,
+**						counting line errors. Runs in the interrupt handler
+**
+** parameters:			portNum(0 or 1)
+** Returned value:		None
+** 
+*****************************************************************************/
+static void UARTRxDrain( uint32_t portNum )
+{
+	LPC_UART_TypeDef *LPC_UART;
+	volatile uint8_t *UARTRxBuffer;
+	volatile uint32_t *UARTRxHead;
+	volatile UART_RX_ERRORS *UARTRxErrors;
+	uint32_t head, tail;
+	uint8_t LSRValue, data;
+
+	UARTRxBuffer = (portNum == 0 ? UART0RxBuffer : UART1RxBuffer);
+	UARTRxHead = (portNum == 0 ? &UART0RxHead : &UART1RxHead);
+	UARTRxErrors = (portNum == 0 ? &UART0RxErrors : &UART1RxErrors);
+	LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
+
+	head = *UARTRxHead;
+	tail = (portNum == 0 ? UART0RxTail : UART1RxTail);
+
+	/* reading LSR clears OE and FE, which belong to the byte at the top of
+	   the FIFO. Reading RBR clears the RDA and CTI interrupts */
+	while ( 1 ){
+		LSRValue = LPC_UART->LSR;
+		if ( LSRValue & LSR_OE )
+			UARTRxErrors->Overruns++;
+		if ( !(LSRValue & LSR_RDR) )
+			break;
+		if ( LSRValue & LSR_FE )
+			UARTRxErrors->FramingErrors++;
+
+		data = LPC_UART->RBR;
+		if ( head - tail == RX_BUFSIZE ){
+			/* the reader may have made room since */
+			tail = (portNum == 0 ? UART0RxTail : UART1RxTail);
+			if ( head - tail == RX_BUFSIZE ){
+				UARTRxErrors->Dropped++;
+				continue;
+			}
+		}
+		UARTRxBuffer[head & (RX_BUFSIZE - 1)] = data;
+		head++;
+		/* published per byte, the reader can start on them right away */
+		*UARTRxHead = head;
+	}
+}
+
+/*****************************************************************************
+** Function name:		UARTTxFill
+**
+** Descriptions:		Move up to TX_FIFO_LEN bytes from the transmit ring
+**						into the empty THR FIFO. Runs in the THRE interrupt,
+**						or with the THRE interrupt disabled
+**
+** parameters:			portNum(0 or 1)
+** Returned value:		None
+** 
+*****************************************************************************/
+static void UARTTxFill( uint32_t portNum )
+{
+	LPC_UART_TypeDef *LPC_UART;
+	volatile uint8_t *UARTTxBuffer;
+	volatile uint32_t *UARTTxTail;
+	uint32_t head, tail, end;
+
+	UARTTxBuffer = (portNum == 0 ? UART0TxBuffer : UART1TxBuffer);
+	UARTTxTail = (portNum == 0 ? &UART0TxTail : &UART1TxTail);
+	LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
+
+	head = (portNum == 0 ? UART0TxHead : UART1TxHead);
+	tail = *UARTTxTail;
+	end = tail + TX_FIFO_LEN;
+
+	while ( tail != head && tail != end ){
+		LPC_UART->THR = UARTTxBuffer[tail & (TX_BUFSIZE - 1)];
+		tail++;
+	}
+
+	*UARTTxTail = tail;
+}
+
 
 /*****************************************************************************
 ** Function name:		UART0_IRQHandler
@@ -89,38 +189,20 @@ void FreeSnd(uint8_t portNum){
 *****************************************************************************/
 void UART0_IRQHandler (void) 
 {
-	uint8_t IIRValue, LSRValue;
+	uint8_t IIRValue;
 
 	IIRValue = LPC_UART0->IIR;
 
 	IIRValue >>= 1;			/* skip pending bit in IIR */
 	IIRValue &= 0x07;			/* check bit 1~3, interrupt identification */
 
-	LSRValue = LPC_UART0->LSR;
-
-	if ( LSRValue & LSR_RDR )	/* Receive Data Ready */	
-	{
-		/* If no error on RLS, normal ready, save into the data buffer. */
-		/* Note: read RBR will clear the interrupt */
-		UART0Buffer[UART0Count] = LPC_UART0->RBR;
-		UART0Count++;
-		if ( UART0Count == BUFSIZE )
-		{
-		UART0Count = 0;		/* buffer overflow */
-		}
-	}
+	/* RLS, RDA and CTI all leave bytes or errors to pick up in the LSR */
+	UARTRxDrain( 0 );
 
 	if ( IIRValue == IIR_THRE )	/* THRE, transmit holding register empty */
 	{
-	/* THRE interrupt */
-		LSRValue = LPC_UART0->LSR;		/* Check status in the LSR to see if
-									valid data in U0THR or not */
-		if ( LSRValue & LSR_THRE ){
-			UART0TxEmpty = 1;
-		}
-		else{
-			UART0TxEmpty = 0;
-		}
+		/* THRE interrupt, the whole FIFO is free. Reading IIR cleared it */
+		UARTTxFill( 0 );
 	}
 
 }
@@ -136,38 +218,20 @@ void UART0_IRQHandler (void)
 *****************************************************************************/
 void UART1_IRQHandler (void) 
 {
-
-	uint8_t IIRValue, LSRValue;
+	uint8_t IIRValue;
 
 	IIRValue = LPC_UART1->IIR;
 
 	IIRValue >>= 1;			/* skip pending bit in IIR */
 	IIRValue &= 0x07;			/* check bit 1~3, interrupt identification */
 
-	LSRValue = LPC_UART1->LSR;
-
-	if ( LSRValue & LSR_RDR )	/* Receive Data Ready */	
-	{
-		/* If no error on RLS, normal ready, save into the data buffer. */
-		/* Note: read RBR will clear the interrupt */
-		UART1Buffer[UART1Count] = LPC_UART1->RBR;
-		UART1Count++;
-		if ( UART1Count == BUFSIZE ){
-		UART0Count = 0;		/* buffer overflow */
-		}
-	}
+	/* RLS, RDA and CTI all leave bytes or errors to pick up in the LSR */
+	UARTRxDrain( 1 );
 
 	if ( IIRValue == IIR_THRE )	/* THRE, transmit holding register empty */
 	{
-	/* THRE interrupt */
-		LSRValue = LPC_UART1->LSR;		/* Check status in the LSR to see if
-									valid data in U0THR or not */
-		if ( LSRValue & LSR_THRE ){
-			UART1TxEmpty = 1;
-		}
-		else{
-			UART1TxEmpty = 0;
-		}
+		/* THRE interrupt, the whole FIFO is free. Reading IIR cleared it */
+		UARTTxFill( 1 );
 	}
 
 }
@@ -230,12 +294,19 @@ uint32_t UARTInit( uint32_t PortNum, uint32_t baudrate )
 		LPC_UART0->DLL = Fdiv % 256;
 
 		LPC_UART0->LCR = 0x03;		/* DLAB = 0 */
-		LPC_UART0->FCR = 0x07;		/* Enable and reset TX and RX FIFO. */
+		LPC_UART0->FCR = 0x87;		/* Enable and reset TX and RX FIFO, RDA at 8 bytes. */
+
+		UART0TxHead = 0;
+		UART0TxTail = 0;
+		UART0RxHead = 0;
+		UART0RxTail = 0;
+		UART0RxErrors.Overruns = 0;
+		UART0RxErrors.FramingErrors = 0;
+		UART0RxErrors.Dropped = 0;
 
 	 	NVIC_EnableIRQ(UART0_IRQn);
 
-		//LPC_UART0->IER = IER_RBR | IER_THRE | IER_RLS;	/* Enable UART0 interrupt */
-		//LPC_UART0->IER =  IER_THRE ;//| IER_RLS;			/* Disable RBR */
+		LPC_UART0->IER = IER_RBR | IER_RLS;	/* Receive all the time, THRE is enabled by the first send */
 
 		FreeRcv(0);
 		FreeSnd(0);
@@ -258,11 +329,19 @@ uint32_t UARTInit( uint32_t PortNum, uint32_t baudrate )
 		LPC_UART1->DLL = Fdiv % 256;
 
 		LPC_UART1->LCR = 0x03;		/* DLAB = 0 */
-		LPC_UART1->FCR = 0x07;		/* Enable and reset TX and RX FIFO. */
+		LPC_UART1->FCR = 0x87;		/* Enable and reset TX and RX FIFO, RDA at 8 bytes. */
+
+		UART1TxHead = 0;
+		UART1TxTail = 0;
+		UART1RxHead = 0;
+		UART1RxTail = 0;
+		UART1RxErrors.Overruns = 0;
+		UART1RxErrors.FramingErrors = 0;
+		UART1RxErrors.Dropped = 0;
 
 	 	NVIC_EnableIRQ(UART1_IRQn);
 
-		//LPC_UART1->IER = IER_RBR | IER_THRE | IER_RLS;	/* Enable UART1 interrupt */
+		LPC_UART1->IER = IER_RBR | IER_RLS;	/* Receive all the time, THRE is enabled by the first send */
 
 		FreeRcv(1);
 		FreeSnd(1);
@@ -272,11 +351,100 @@ uint32_t UARTInit( uint32_t PortNum, uint32_t baudrate )
 	return( FALSE ); 
 }
 
+/*****************************************************************************
+** Function name:		UARTTxSpace
+**
+** Descriptions:		Free space in the transmit ring of a UART port
+**
+** parameters:			portNum
+** Returned value:		Bytes that can be queued without waiting
+** 
+*****************************************************************************/
+uint32_t UARTTxSpace( uint32_t portNum )
+{
+	if((portNum >> 1 ) != 0)
+		return 0;
+
+	if ( portNum == 0 )
+		return TX_BUFSIZE - (UART0TxHead - UART0TxTail);
+	return TX_BUFSIZE - (UART1TxHead - UART1TxTail);
+}
+
+/*****************************************************************************
+** Function name:		UARTTxPut
+**
+** Descriptions:		Copy as much of a block of data as fits into the
+**						transmit ring and start the transmitter if it is
+**						idle. Must be called holding the send lock
+**
+** parameters:			portNum, buffer pointer, and data length
+** Returned value:		Number of bytes queued
+** 
+*****************************************************************************/
+static uint32_t UARTTxPut( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
+{
+	LPC_UART_TypeDef *LPC_UART;
+	volatile uint8_t *UARTTxBuffer;
+	volatile uint32_t *UARTTxHead;
+	uint32_t head, queued, i;
+
+	UARTTxBuffer = (portNum == 0 ? UART0TxBuffer : UART1TxBuffer);
+	UARTTxHead = (portNum == 0 ? &UART0TxHead : &UART1TxHead);
+	LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
+
+	queued = UARTTxSpace(portNum);
+	if ( queued > Length )
+		queued = Length;
+
+	head = *UARTTxHead;
+	for ( i = 0; i < queued; ++i )
+		UARTTxBuffer[(head + i) & (TX_BUFSIZE - 1)] = BufferPtr[i];
+	*UARTTxHead = head + queued;
+
+	/* THRE only interrupts when the FIFO runs empty, so an idle transmitter
+	   has to be started here. While THRE is masked the handler can not take
+	   bytes off the ring at the same time */
+	LPC_UART->IER &= ~IER_THRE;
+	if ( LPC_UART->LSR & LSR_THRE )
+		UARTTxFill(portNum);
+	LPC_UART->IER |= IER_THRE;
+
+	return queued;
+}
+
+/*****************************************************************************
+** Function name:		UARTTxQueue
+**
+** Descriptions:		Queue as much of a block of data as fits into the
+**						transmit ring of the UART 0-1 port, without waiting
+**						for the line
+**
+** parameters:			portNum, buffer pointer, and data length
+** Returned value:		Number of bytes queued, the rest did not fit
+** 
+*****************************************************************************/
+uint32_t UARTTxQueue( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
+{
+	uint32_t queued;
+
+	if((portNum >> 1 ) != 0)
+		return 0;
+
+	while( LockSnd(portNum));
+	queued = UARTTxPut(portNum, BufferPtr, Length);
+	FreeSnd(portNum);
+
+	return queued;
+}
+
 /*****************************************************************************
 ** Function name:		UARTSend
 **
-** Descriptions:		Send a block of data to the UART 0 port based
-**						on the data length
+** Descriptions:		Send a block of data to the UART 0-1 port based
+**						on the data length. Returns once the data is in
+**						the transmit ring, waiting only while the ring is
+**						full. Must not be called with interrupts disabled
+**						then
 **
 ** parameters:			portNum, buffer pointer, and data length
 ** Returned value:		None
@@ -285,48 +453,51 @@ uint32_t UARTInit( uint32_t PortNum, uint32_t baudrate )
 
 void UARTSend( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
 {
-	LPC_UART_TypeDef *LPC_UART;
-	volatile unsigned char *UARTTxEmpty;				//ASK Douglas
-	uint8_t *localBufferPtr;
-	uint32_t localLength;
+	uint32_t queued;
 
 	if((portNum >> 1 ) != 0)
 		return;
 
-	localLength = Length;
-	localBufferPtr = BufferPtr;
-	UARTTxEmpty = (portNum == 0 ? &UART0TxEmpty : &UART1TxEmpty);
-	LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
-
-	//Enable interupt
-	LPC_UART->IER |=  IER_THRE;
-
+	/* held for the whole block, so blocks from two senders do not mix */
 	while( LockSnd(portNum));
 
-	while ( localLength != 0 ){
-		/* THRE status, contain valid data */
-		while ( !(*UARTTxEmpty & 0x01) );
-		LPC_UART->THR = *localBufferPtr;
-		*UARTTxEmpty = 0;	/* not empty in the THR until it shifts out */
-		localBufferPtr++;
-		localLength--;
+	while ( Length != 0 ){
+		queued = UARTTxPut(portNum, BufferPtr, Length);
+		BufferPtr += queued;
+		Length -= queued;
 	}
 
 	FreeSnd(portNum);
 
-	//Reanble other interpts
-	LPC_UART->IER &= ~IER_THRE;
-
 	return;
 }
 
+/*****************************************************************************
+** Function name:		UARTTxFlush
+**
+** Descriptions:		Wait until everything queued on the UART 0-1 port
+**						has left the shift register
+**
+** parameters:			portNum
+** Returned value:		None
+** 
+*****************************************************************************/
+void UARTTxFlush( uint32_t portNum )
+{
+	LPC_UART_TypeDef *LPC_UART;
+
+	if((portNum >> 1 ) != 0)
+		return;
+
+	LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
+
+	while ( UARTTxSpace(portNum) != TX_BUFSIZE || !(LPC_UART->LSR & LSR_TEMT) );
+}
+
 void UARTSendChar( uint32_t portNum, uint8_t character)
 {
 	#ifdef __RTGT_UART
-		LPC_UART_TypeDef *LPC_UART;
-		LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
-		while (!(LPC_UART->LSR & 0x20));
-		LPC_UART->THR = character;
+		UARTSend(portNum, &character, 1);
 	#else
 		ITM_SendChar(character);
 	#endif
@@ -335,56 +506,128 @@ void UARTSendChar( uint32_t portNum, uint8_t character)
 
 
 /*****************************************************************************
-** Function name:		UARTRecieve
+** Function name:		UARTRxAvailable
 **
-** Descriptions:		Recieve a block of data to the UART 0-1 port based
-**						on the data length
+** Descriptions:		Bytes waiting in the receive ring of a UART port
 **
-** parameters:			portNum, buffer pointer, and data length
-** Returned value:		integer showing status
+** parameters:			portNum
+** Returned value:		Number of bytes that can be read without waiting
 ** 
 *****************************************************************************/
-uint32_t UARTRecieve( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
+uint32_t UARTRxAvailable( uint32_t portNum )
 {
-
-	LPC_UART_TypeDef *LPC_UART;
-	volatile uint32_t *UARTCount;				//ASK Douglas
-	volatile uint8_t *UARTBuffer;
-	uint8_t *rcvdBufferPtr;
-	uint32_t rcvd_len, i;
-
 	if((portNum >> 1 ) != 0)
 		return 0;
 
-	rcvd_len = 0x0;
-	rcvdBufferPtr = BufferPtr;
-	UARTCount = (portNum == 0 ? &UART0Count : &UART1Count);
-	UARTBuffer = (portNum == 0 ? UART0Buffer : UART1Buffer);
-	LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
+	if ( portNum == 0 )
+		return UART0RxHead - UART0RxTail;
+	return UART1RxHead - UART1RxTail;
+}
 
-	*UARTCount = 0x0;
+/*****************************************************************************
+** Function name:		UARTRxGet
+**
+** Descriptions:		Copy up to Length received bytes out of the receive
+**						ring. Must be called holding the receive lock
+**
+** parameters:			portNum, buffer pointer, and buffer length
+** Returned value:		Number of bytes copied
+** 
+*****************************************************************************/
+static uint32_t UARTRxGet( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
+{
+	volatile uint8_t *UARTRxBuffer;
+	volatile uint32_t *UARTRxTail;
+	uint32_t tail, rcvd_len, i;
+
+	UARTRxBuffer = (portNum == 0 ? UART0RxBuffer : UART1RxBuffer);
+	UARTRxTail = (portNum == 0 ? &UART0RxTail : &UART1RxTail);
 
-	//Enable interupt
-	LPC_UART->IER |=  IER_RBR;
+	rcvd_len = UARTRxAvailable(portNum);
+	if ( rcvd_len > Length )
+		rcvd_len = Length;
 
-	//busy waiting
+	tail = *UARTRxTail;
+	for ( i = 0; i < rcvd_len; ++i )
+		BufferPtr[i] = UARTRxBuffer[(tail + i) & (RX_BUFSIZE - 1)];
+	/* the handler may reuse the slots once the tail moves past them */
+	*UARTRxTail = tail + rcvd_len;
+
+	return rcvd_len;
+}
 
-	while( *UARTCount == 0 );
+/*****************************************************************************
+** Function name:		UARTRxRead
+**
+** Descriptions:		Copy everything received on the UART 0-1 port so
+**						far, up to Length bytes, without waiting
+**
+** parameters:			portNum, buffer pointer, and buffer length
+** Returned value:		Number of bytes copied, 0 if nothing was received
+** 
+*****************************************************************************/
+uint32_t UARTRxRead( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
+{
+	uint32_t rcvd_len;
 
+	if((portNum >> 1 ) != 0)
+		return 0;
 
-	//This part has to be put in the critical section
 	while(LockRcv(portNum));
+	rcvd_len = UARTRxGet(portNum, BufferPtr, Length);
+	FreeRcv(portNum);
+
+	return rcvd_len;
+}
+
+/*****************************************************************************
+** Function name:		UARTRxErrors
+**
+** Descriptions:		Copy the receive error counters of a UART port
+**
+** parameters:			portNum, counters to fill in
+** Returned value:		None
+** 
+*****************************************************************************/
+void UARTRxErrors( uint32_t portNum, UART_RX_ERRORS *Errors )
+{
+	volatile UART_RX_ERRORS *UARTRxErrors;
 
-	//Reanble other interpts
-	LPC_UART->IER &= ~IER_RBR;			/* Disable RBR */
+	if((portNum >> 1 ) != 0)
+		return;
+
+	UARTRxErrors = (portNum == 0 ? &UART0RxErrors : &UART1RxErrors);
+	Errors->Overruns = UARTRxErrors->Overruns;
+	Errors->FramingErrors = UARTRxErrors->FramingErrors;
+	Errors->Dropped = UARTRxErrors->Dropped;
+}
 
+/*****************************************************************************
+** Function name:		UARTRecieve
+**
+** Descriptions:		Recieve a block of data from the UART 0-1 port,
+**						waiting until at least one byte has arrived
+**
+** parameters:			portNum, buffer pointer, and buffer length
+** Returned value:		Number of bytes received, at most Length
+** 
+*****************************************************************************/
+uint32_t UARTRecieve( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
+{
+	uint32_t rcvd_len;
 
-	for(i = 0; i < *UARTCount; ++i)
-		rcvdBufferPtr[rcvd_len++] = UARTBuffer[i];
+	if((portNum >> 1 ) != 0 || Length == 0)
+		return 0;
 
-	*UARTCount = 0;
+	do {
+		//busy waiting, bytes that arrived before the call are already in the ring
+		while( UARTRxAvailable(portNum) == 0 );
 
-	FreeRcv(portNum);
+		//another reader may have taken them meanwhile
+		while(LockRcv(portNum));
+		rcvd_len = UARTRxGet(portNum, BufferPtr, Length);
+		FreeRcv(portNum);
+	} while ( rcvd_len == 0 );
 
 	return rcvd_len;
 }
@@ -392,14 +635,11 @@ uint32_t UARTRecieve( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length )
 uint8_t UARTReceiveChar( uint32_t portNum)
 {
 	#ifdef __RTGT_UART
-		/*uint8_t ret[1];
+		/* the handler owns RBR, so read from the ring */
+		uint8_t ret[1];
 		if (UARTRecieve(portNum, ret, 1) == 1)
 			return ret[0];
-		return 0x0;	*/
-		LPC_UART_TypeDef *LPC_UART;
-		LPC_UART = (portNum == 0 ? (LPC_UART_TypeDef *)LPC_UART0 : (LPC_UART_TypeDef *)LPC_UART1 );
-		while (!(LPC_UART->LSR & 0x01));
-		return (LPC_UART->RBR);
+		return 0x0;
 	#else
 		while (ITM_CheckChar() != 1) __NOP();
 		return (ITM_ReceiveChar());
@@ -41,7 +41,16 @@
 #define LSR_TEMT	0x40
 #define LSR_RXFE	0x80
 
-#define BUFSIZE		0x40
+#define RX_BUFSIZE	0x100		/* receive ring of each port, a power of two */
+#define TX_BUFSIZE	0x100		/* transmit ring of each port, a power of two */
+#define TX_FIFO_LEN	16			/* bytes the THR FIFO takes once it is empty */
+
+/* Receive errors of a port since UARTInit */
+typedef struct {
+	uint32_t Overruns;		/* LSR_OE, bytes lost because the RX FIFO was full */
+	uint32_t FramingErrors;	/* LSR_FE, bytes received without a valid stop bit */
+	uint32_t Dropped;		/* bytes received while the receive ring was full */
+} UART_RX_ERRORS;
 
 #ifndef FALSE
 #define FALSE   (0)
@@ -61,6 +70,14 @@ void     UARTSend(    uint32_t portNum, uint8_t *BufferPtr, uint32_t Length );
 uint32_t UARTRecieve( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length );
 
 void     UARTSendChar(    uint32_t portNum, uint8_t character );
+
+uint32_t UARTRxRead(      uint32_t portNum, uint8_t *BufferPtr, uint32_t Length );
+uint32_t UARTRxAvailable( uint32_t portNum );
+void     UARTRxErrors(    uint32_t portNum, UART_RX_ERRORS *Errors );
+
+uint32_t UARTTxQueue( uint32_t portNum, uint8_t *BufferPtr, uint32_t Length );
+uint32_t UARTTxSpace( uint32_t portNum );
+void     UARTTxFlush( uint32_t portNum );
 uint8_t  UARTReceiveChar( uint32_t portNum );
 
 #endif /* end __UART_H */